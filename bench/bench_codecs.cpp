@@ -0,0 +1,247 @@
+#include "crypto.hpp"
+#include "stream.hpp"
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <random>
+
+// Throughput of the hex and base64 codecs, for inputs from 16 B to 1 GB.
+// Besides MB/s (bytes_per_second), every benchmark reports cycles/byte. On x86 these are reference
+// cycles counted with rdtsc, elsewhere they are estimated from the frequency detected by
+// google-benchmark.
+//
+// Run with --benchmark_format=json (or --benchmark_out=<file> --benchmark_out_format=json) to
+// produce JSON, and with e.g. --benchmark_filter='/(16|4096|1048576)$' to skip the large sizes.
+
+static const int64_t MIN_SIZE = 16;
+static const int64_t MAX_SIZE = int64_t(1) << 30;
+
+static bytes random_bytes(size_t n)
+{
+    std::mt19937_64 rng(n);
+    bytes b(n);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t r = rng();
+        memcpy(&b[i], &r, 8);
+    }
+    for (; i < n; i++)
+        b[i] = static_cast<byte>(rng());
+    return b;
+}
+
+static uint64_t cycles()
+{
+#if CRYPTO_X86_SIMD
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now().time_since_epoch())
+                                     .count() *
+                                 benchmark::CPUInfo::Get().cycles_per_second / 1e9);
+#endif
+}
+
+// n is the number of raw (decoded) bytes processed per iteration, elapsed is the number of cycles
+// spent in the benchmark loop
+static void set_counters(benchmark::State &state, size_t n, uint64_t elapsed)
+{
+    double total = static_cast<double>(state.iterations()) * static_cast<double>(n);
+    state.SetBytesProcessed(static_cast<int64_t>(total));
+    state.counters["cycles/byte"] = static_cast<double>(elapsed) / total;
+}
+
+static void BM_hex_from_bytes(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = random_bytes(n);
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        bytes encoded = hex::from_bytes(input);
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_hex_to_bytes(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = hex::from_bytes(random_bytes(n));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        bytes decoded = hex::to_bytes(input);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+// The same conversions into a buffer that is allocated once
+static void BM_hex_from_bytes_into(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = random_bytes(n);
+    bytes output(hex::encoded_size(n));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        hex::from_bytes(input.begin(), input.end(), output.begin());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_hex_to_bytes_into(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = hex::from_bytes(random_bytes(n));
+    bytes output(hex::decoded_size(input.size()));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        hex::to_bytes(input.begin(), input.end(), output.begin());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+// The scalar kernel, as a baseline for the vectorized ones
+static void BM_hex_to_bytes_scalar(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = hex::from_bytes(random_bytes(n));
+    bytes output(n);
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        hex::detail::decode_scalar(input.data(), n, output.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_hex_decoder(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = hex::from_bytes(random_bytes(n));
+    hex::Decoder decoder;
+    bytes output(decoder.max_output_size(input.size()));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        decoder.update(input.data(), input.size(), output.data());
+        decoder.finish(output.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_base64_from_bytes(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = random_bytes(n);
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        bytes encoded = base64::from_bytes(input);
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_base64_to_bytes(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = base64::from_bytes(random_bytes(n));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        bytes decoded = base64::to_bytes(input);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_base64_from_bytes_into(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = random_bytes(n);
+    bytes output(base64::encoded_size(n));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        base64::from_bytes(input.begin(), input.end(), output.begin());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_base64_to_bytes_into(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    bytes input = base64::from_bytes(random_bytes(n));
+    bytes output(base64::decoded_size(input));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        base64::to_bytes(input.begin(), input.end(), output.begin());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+static void BM_base64_to_bytes_scalar(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0)) / 3 * 3;
+    bytes input = base64::from_bytes(random_bytes(n));
+    bytes output(n);
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        base64::detail::decode_scalar(input.data(), n / 3, output.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+// Line wrapped input, as found in MIME encoded files
+static void BM_base64_decoder_mime(benchmark::State &state)
+{
+    size_t n = static_cast<size_t>(state.range(0));
+    base64::Encoder encoder(76);
+    bytes input(encoder.max_output_size(n));
+    bytes raw = random_bytes(n);
+    size_t length = encoder.update(raw.data(), n, input.data());
+    length += encoder.finish(input.data() + length);
+    input.resize(length);
+
+    base64::Decoder decoder;
+    bytes output(decoder.max_output_size(input.size()));
+    uint64_t start = cycles();
+    for (auto _ : state)
+    {
+        decoder.update(input.data(), input.size(), output.data());
+        decoder.finish(output.data());
+        benchmark::ClobberMemory();
+    }
+    set_counters(state, n, cycles() - start);
+}
+
+#define CODEC_BENCHMARK(name)                                                                      \
+    BENCHMARK(name)->RangeMultiplier(16)->Range(MIN_SIZE, MAX_SIZE)->Unit(benchmark::kMicrosecond)
+
+CODEC_BENCHMARK(BM_hex_from_bytes);
+CODEC_BENCHMARK(BM_hex_to_bytes);
+CODEC_BENCHMARK(BM_hex_from_bytes_into);
+CODEC_BENCHMARK(BM_hex_to_bytes_into);
+CODEC_BENCHMARK(BM_hex_to_bytes_scalar);
+CODEC_BENCHMARK(BM_hex_decoder);
+CODEC_BENCHMARK(BM_base64_from_bytes);
+CODEC_BENCHMARK(BM_base64_to_bytes);
+CODEC_BENCHMARK(BM_base64_from_bytes_into);
+CODEC_BENCHMARK(BM_base64_to_bytes_into);
+CODEC_BENCHMARK(BM_base64_to_bytes_scalar);
+CODEC_BENCHMARK(BM_base64_decoder_mime);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,140 @@
+#pragma once
+#include "crypto.hpp"
+#include "single_byte_xor.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <vector>
+
+// Finds the best single byte key of many short ciphertexts at once.
+//
+// The records are packed one after the other into a single arena, with an array of offsets marking
+// where each one starts, so a batch of millions of records costs two allocations instead of one
+// per record. Scoring walks the arena from the start to the end, reusing one histogram per worker,
+// and the results are returned as parallel arrays of keys and scores, indexed like the records.
+namespace single_byte_xor
+{
+class Batch
+{
+  public:
+    size_t size() const { return offsets_.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    // Total length of the records
+    size_t bytes_size() const { return arena_.size(); }
+
+    const byte *data(size_t record) const { return arena_.data() + offsets_[record]; }
+    size_t length(size_t record) const { return offsets_[record + 1] - offsets_[record]; }
+
+    // Record i is [offsets()[i], offsets()[i + 1]) in arena()
+    const bytes &arena() const { return arena_; }
+    const std::vector<size_t> &offsets() const { return offsets_; }
+
+    void reserve(size_t records, size_t total_length)
+    {
+        offsets_.reserve(records + 1);
+        arena_.reserve(total_length);
+    }
+
+    // Adds a record of n bytes and returns where to write them
+    byte *append(size_t n)
+    {
+        arena_.resize(arena_.size() + n);
+        offsets_.push_back(arena_.size());
+        return arena_.data() + offsets_[offsets_.size() - 2];
+    }
+
+    void add(const byte *data, size_t n)
+    {
+        byte *record = append(n);
+        if (n > 0)
+            memcpy(record, data, n);
+    }
+
+    template <typename T> void add(const T &record)
+    {
+        add(::detail::container_data(record), record.size());
+    }
+
+    // Removes the last record
+    void pop_back()
+    {
+        if (empty())
+            throw std::logic_error("Batch is empty");
+        offsets_.pop_back();
+        arena_.resize(offsets_.back());
+    }
+
+    // Removes all records but keeps the memory, so that a batch can be refilled
+    void clear()
+    {
+        arena_.clear();
+        offsets_.assign(1, 0);
+    }
+
+  private:
+    bytes arena_;
+    std::vector<size_t> offsets_ = std::vector<size_t>(1, 0);
+};
+
+struct BatchScores
+{
+    // Best key of every record, the lowest one if several keys have the same score
+    std::vector<byte> keys;
+    std::vector<int64_t> scores;
+};
+
+namespace detail
+{
+// Scores the records [begin, end) of a batch into keys and scores, indexed by record
+inline void score_records(const Batch &batch, size_t begin, size_t end, const KeyScorer &scorer,
+                          byte *keys, int64_t *scores)
+{
+    Histogram h{};
+    for (size_t r = begin; r < end; r++)
+    {
+        const byte *data = batch.data(r);
+        size_t n = batch.length(r);
+        for (size_t i = 0; i < n; i++)
+            h[data[i]]++;
+        Candidate best = best_key(scorer.score_keys(h));
+        keys[r] = best.key;
+        scores[r] = best.score;
+        // Only the counters of this record have to be reset, not the whole histogram
+        for (size_t i = 0; i < n; i++)
+            h[data[i]] = 0;
+    }
+}
+} // namespace detail
+
+// Number of records scored by one task of score_batch
+const size_t BATCH_TASK_RECORDS = 4096;
+
+// The best key and its score for every record of the batch, scored on the workers of the pool
+inline BatchScores score_batch(const Batch &batch, const KeyScorer &scorer,
+                               ThreadPool &pool = ThreadPool::shared())
+{
+    BatchScores result;
+    result.keys.resize(batch.size());
+    result.scores.resize(batch.size());
+    size_t tasks = (batch.size() + BATCH_TASK_RECORDS - 1) / BATCH_TASK_RECORDS;
+    if (tasks == 1)
+    {
+        detail::score_records(batch, 0, batch.size(), scorer, result.keys.data(),
+                              result.scores.data());
+        return result;
+    }
+    pool.parallel_for(tasks, [&](size_t task) {
+        size_t begin = task * BATCH_TASK_RECORDS;
+        size_t end = std::min(batch.size(), begin + BATCH_TASK_RECORDS);
+        detail::score_records(batch, begin, end, scorer, result.keys.data(),
+                              result.scores.data());
+    });
+    return result;
+}
+
+inline BatchScores score_batch(const Batch &batch, const int (&weights)[256],
+                               ThreadPool &pool = ThreadPool::shared())
+{
+    return score_batch(batch, KeyScorer(weights), pool);
+}
+} // namespace single_byte_xor
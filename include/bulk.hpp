@@ -0,0 +1,270 @@
+#pragma once
+#include "crypto.hpp"
+#include "mapped_file.hpp"
+#include "stream.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parallel hex / base64 transcoding of large buffers and files. The input is split into chunks
+// at line boundaries, the size of every chunk's output is worked out first so that the output
+// can be allocated once, then all chunks are transcoded at the same time, each one straight into
+// its own part of the output.
+namespace bulk
+{
+enum class Operation
+{
+    hex_encode,
+    hex_decode,
+    base64_encode,
+    base64_decode,
+};
+
+struct Options
+{
+    // Approximate number of input bytes handled by one task
+    size_t chunk_size = 4 << 20;
+    // Line length of the base64 encoder's output, see base64::Encoder
+    size_t line_length = 0;
+};
+
+namespace detail
+{
+struct Chunk
+{
+    size_t begin;
+    size_t end;
+    // Number of non whitespace characters, only used for decoding
+    size_t characters;
+    size_t output_offset;
+    size_t output_size;
+};
+
+// Splits [0, n) into chunks of about chunk_size bytes, each chunk except the last one ends
+// with a newline if there is one close enough
+inline std::vector<Chunk> split_lines(const byte *in, size_t n, size_t chunk_size)
+{
+    std::vector<Chunk> chunks;
+    size_t begin = 0;
+    while (begin < n)
+    {
+        size_t end = std::min(n, begin + chunk_size);
+        if (end < n)
+        {
+            size_t limit = std::min(n, end + chunk_size);
+            auto newline = static_cast<const byte *>(memchr(in + end, '\n', limit - end));
+            if (newline != nullptr)
+                end = static_cast<size_t>(newline - in) + 1;
+        }
+        chunks.push_back({begin, end, 0, 0, 0});
+        begin = end;
+    }
+    return chunks;
+}
+
+// Moves the chunk boundaries forward so that every chunk holds a multiple of unit characters,
+// chunks too small to give up enough characters are merged with the previous one
+inline void align_chunks(const byte *in, std::vector<Chunk> &chunks, size_t unit)
+{
+    size_t k = 0;
+    while (k + 1 < chunks.size())
+    {
+        Chunk &chunk = chunks[k];
+        Chunk &next = chunks[k + 1];
+        size_t needed = (unit - chunk.characters % unit) % unit;
+        if (needed == 0)
+        {
+            k++;
+        }
+        else if (next.characters <= needed)
+        {
+            chunk.end = next.end;
+            chunk.characters += next.characters;
+            chunks.erase(chunks.begin() + static_cast<std::ptrdiff_t>(k + 1));
+        }
+        else
+        {
+            size_t i = next.begin;
+            for (size_t moved = 0; moved < needed; i++)
+            {
+                if (!::detail::is_space(in[i]))
+                    moved++;
+            }
+            chunk.end = next.begin = i;
+            chunk.characters += needed;
+            next.characters -= needed;
+            k++;
+        }
+    }
+}
+
+// Returns the last non whitespace character before end, or 0 if there is none
+inline byte last_character(const byte *in, size_t begin, size_t &end)
+{
+    while (end > begin && ::detail::is_space(in[end - 1]))
+        end--;
+    return end > begin ? in[--end] : 0;
+}
+
+// Works out the output of each chunk of base-16 / base-64 text and returns the total size
+inline size_t plan_decode(Operation op, const byte *in, std::vector<Chunk> &chunks,
+                          ThreadPool &pool)
+{
+    pool.parallel_for(chunks.size(), [in, &chunks](size_t k) {
+        Chunk &chunk = chunks[k];
+        auto count = [&chunk](const byte *, size_t length) { chunk.characters += length; };
+        ::detail::for_each_run(in + chunk.begin, chunk.end - chunk.begin, count);
+    });
+    size_t total = 0;
+    for (const auto &chunk : chunks)
+        total += chunk.characters;
+
+    size_t unit = op == Operation::hex_decode ? 2 : 4;
+    if (total % unit != 0)
+    {
+        if (op == Operation::hex_decode)
+            hex::detail::throw_invalid_length(total);
+        base64::detail::throw_invalid_length(total);
+    }
+    align_chunks(in, chunks, unit);
+    // Chunks with nothing but whitespace do not produce any output
+    chunks.erase(std::remove_if(chunks.begin(), chunks.end(),
+                                [](const Chunk &chunk) { return chunk.characters == 0; }),
+                 chunks.end());
+
+    size_t offset = 0;
+    for (size_t k = 0; k < chunks.size(); k++)
+    {
+        Chunk &chunk = chunks[k];
+        if (op == Operation::hex_decode)
+        {
+            chunk.output_size = chunk.characters / 2;
+        }
+        else
+        {
+            chunk.output_size = chunk.characters / 4 * 3;
+            size_t end = chunk.end;
+            byte last = last_character(in, chunk.begin, end);
+            if (last == '=')
+            {
+                // Only the end of the input may be padded
+                if (k + 1 != chunks.size())
+                    base64::detail::throw_invalid_padding();
+                chunk.output_size -= last_character(in, chunk.begin, end) == '=' ? 2 : 1;
+            }
+        }
+        chunk.output_offset = offset;
+        offset += chunk.output_size;
+    }
+    return offset;
+}
+
+// Splits raw input into chunks whose encoded form is made of whole groups / lines
+inline size_t plan_encode(Operation op, size_t n, std::vector<Chunk> &chunks,
+                          const Options &options)
+{
+    size_t unit = 1;
+    if (op == Operation::base64_encode)
+        unit = options.line_length != 0 ? options.line_length / 4 * 3 : 3;
+    size_t chunk_size = std::max(unit, options.chunk_size / unit * unit);
+
+    size_t offset = 0;
+    for (size_t begin = 0; begin < n; begin += chunk_size)
+    {
+        size_t end = std::min(n, begin + chunk_size);
+        size_t output_size = hex::encoded_size(end - begin);
+        if (op == Operation::base64_encode)
+        {
+            output_size = base64::encoded_size(end - begin);
+            if (options.line_length != 0)
+                output_size += (output_size + options.line_length - 1) / options.line_length;
+        }
+        chunks.push_back({begin, end, 0, offset, output_size});
+        offset += output_size;
+    }
+    return offset;
+}
+
+template <typename Codec>
+inline void transcode_chunk(Codec codec, const byte *in, const Chunk &chunk, byte *out)
+{
+    byte *p = out + chunk.output_offset;
+    size_t written = codec.update(in + chunk.begin, chunk.end - chunk.begin, p);
+    written += codec.finish(p + written);
+    assert(written == chunk.output_size);
+    (void)written;
+}
+} // namespace detail
+
+// Transcodes n bytes starting at in. allocate(size) is called once, before any output is written,
+// and must return a buffer of size bytes. Returns the size of the output.
+template <typename Allocate>
+inline size_t transcode(Operation op, const byte *in, size_t n, Allocate allocate,
+                        ThreadPool &pool = ThreadPool::shared(), const Options &options = Options())
+{
+    if (options.line_length != 0 && op != Operation::base64_encode)
+        throw std::logic_error("Line length can only be used for base64 encoding");
+    // Also checks the line length
+    base64::Encoder line_encoder(options.line_length);
+
+    std::vector<detail::Chunk> chunks;
+    size_t total;
+    if (op == Operation::hex_decode || op == Operation::base64_decode)
+    {
+        chunks = detail::split_lines(in, n, std::max<size_t>(options.chunk_size, 1));
+        total = detail::plan_decode(op, in, chunks, pool);
+    }
+    else
+    {
+        total = detail::plan_encode(op, n, chunks, options);
+    }
+
+    byte *out = allocate(total);
+    pool.parallel_for(chunks.size(), [&](size_t k) {
+        switch (op)
+        {
+        case Operation::hex_encode:
+            detail::transcode_chunk(hex::Encoder(), in, chunks[k], out);
+            break;
+        case Operation::hex_decode:
+            detail::transcode_chunk(hex::Decoder(), in, chunks[k], out);
+            break;
+        case Operation::base64_encode:
+            detail::transcode_chunk(line_encoder, in, chunks[k], out);
+            break;
+        case Operation::base64_decode:
+            detail::transcode_chunk(base64::Decoder(), in, chunks[k], out);
+            break;
+        }
+    });
+    return total;
+}
+
+// Transcodes the file at in_path into a new file at out_path, which is removed again if the input
+// turns out to be invalid. Returns the size of the output.
+inline uint64_t transcode_file(Operation op, const std::string &in_path,
+                               const std::string &out_path, ThreadPool &pool = ThreadPool::shared(),
+                               const Options &options = Options())
+{
+    MappedFile in(in_path);
+    std::unique_ptr<MappedFile> out;
+    auto allocate = [&out, &out_path](size_t size) {
+        out.reset(new MappedFile(out_path, size));
+        return out->data();
+    };
+    try
+    {
+        return transcode(op, in.data(), in.size(), allocate, pool, options);
+    }
+    catch (...)
+    {
+        if (out)
+        {
+            out.reset();
+            ::unlink(out_path.c_str());
+        }
+        throw;
+    }
+}
+} // namespace bulk
@@ -0,0 +1,106 @@
+#pragma once
+#include "crypto.hpp"
+#include "single_byte_xor.hpp"
+#include <algorithm>
+#include <vector>
+
+// Splits a ciphertext into the columns of a repeating key: column c holds the bytes at positions
+// c, c + key_size, c + 2 * key_size ... which are all XORed with the same key byte.
+//
+// The ciphertext is read as rows of key_size bytes. transpose copies the columns one after the
+// other into a single buffer, a tile of rows at a time so that the rows being read stay in the
+// cache while every column receives a contiguous run of bytes. When only the statistics of the
+// columns are needed, histograms counts them straight from the rows without copying anything, and
+// add_to_histograms does the same for a stream, one chunk at a time.
+namespace columns
+{
+// Columns before n % key_size have one more byte than the others
+inline size_t column_length(size_t n, size_t key_size, size_t column)
+{
+    return n / key_size + (column < n % key_size ? 1 : 0);
+}
+
+// Position of a column in the output of transpose
+inline size_t column_offset(size_t n, size_t key_size, size_t column)
+{
+    return column * (n / key_size) + std::min(column, n % key_size);
+}
+
+// Rows copied at a time by transpose, a tile of up to 4096 * key_size bytes
+const size_t TILE_ROWS = 4096;
+
+// Writes the n bytes of data into out column after column, out must hold n bytes
+inline void transpose(const byte *data, size_t n, size_t key_size, byte *out)
+{
+    if (key_size == 0)
+        throw std::logic_error("Key size cannot be zero");
+    size_t rows = (n + key_size - 1) / key_size;
+    std::vector<byte *> column_out(key_size);
+    for (size_t c = 0; c < key_size; c++)
+        column_out[c] = out + column_offset(n, key_size, c);
+
+    for (size_t tile = 0; tile < rows; tile += TILE_ROWS)
+    {
+        // Only full rows in the tile, the last partial row is copied below
+        size_t tile_end = std::min(tile + TILE_ROWS, n / key_size);
+        for (size_t c = 0; c < key_size; c++)
+        {
+            const byte *in = data + tile * key_size + c;
+            byte *column = column_out[c];
+            for (size_t r = tile; r < tile_end; r++, in += key_size)
+                *column++ = *in;
+            column_out[c] = column;
+        }
+    }
+    for (size_t c = 0; c < n % key_size; c++)
+        *column_out[c] = data[n - n % key_size + c];
+}
+
+inline bytes transpose(const byte *data, size_t n, size_t key_size)
+{
+    bytes out(n);
+    transpose(data, n, key_size, out.data());
+    return out;
+}
+
+template <typename T> inline bytes transpose(const T &text, size_t key_size)
+{
+    return transpose(::detail::container_data(text), text.size(), key_size);
+}
+
+// Adds the bytes of data to the histograms h[0 .. key_size) of the columns, data[0] being in
+// column first_column. Lets the histograms of a stream be built one chunk after the other
+inline void add_to_histograms(const byte *data, size_t n, size_t key_size, size_t first_column,
+                              single_byte_xor::Histogram *h)
+{
+    size_t i = 0;
+    // Up to the start of the first full row
+    for (size_t c = first_column; c != 0 && c < key_size && i < n; i++, c++)
+        h[c][data[i]]++;
+    for (; i + key_size <= n; i += key_size)
+    {
+        const byte *row = data + i;
+        for (size_t c = 0; c < key_size; c++)
+            h[c][row[c]]++;
+    }
+    for (size_t c = 0; i < n; i++, c++)
+        h[c][data[i]]++;
+}
+
+// The histogram of every column, in one pass over data
+inline std::vector<single_byte_xor::Histogram> histograms(const byte *data, size_t n,
+                                                           size_t key_size)
+{
+    if (key_size == 0)
+        throw std::logic_error("Key size cannot be zero");
+    std::vector<single_byte_xor::Histogram> h(key_size, single_byte_xor::Histogram{});
+    add_to_histograms(data, n, key_size, 0, h.data());
+    return h;
+}
+
+template <typename T>
+inline std::vector<single_byte_xor::Histogram> histograms(const T &text, size_t key_size)
+{
+    return histograms(::detail::container_data(text), text.size(), key_size);
+}
+} // namespace columns
@@ -0,0 +1,53 @@
+#pragma once
+
+// Runtime detection of the instruction set extensions used by the vectorized kernels.
+// The kernels are compiled with per function target attributes, so the project itself is still
+// built for the baseline architecture and the fastest kernel is picked on the machine it runs on.
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRYPTO_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define CRYPTO_X86_SIMD 0
+#endif
+
+namespace cpu
+{
+struct Features
+{
+    bool popcnt = false;
+    // AES-NI
+    bool aes = false;
+    bool ssse3 = false;
+    bool avx2 = false;
+    bool avx512f = false;
+    // AVX-512 Foundation + Byte/Word instructions
+    bool avx512bw = false;
+    // AVX-512 Foundation + 64 bit population count
+    bool avx512vpopcntdq = false;
+};
+
+inline Features detect_features()
+{
+    Features f;
+#if CRYPTO_X86_SIMD
+    __builtin_cpu_init();
+    f.popcnt = __builtin_cpu_supports("popcnt");
+    f.aes = __builtin_cpu_supports("aes");
+    f.ssse3 = __builtin_cpu_supports("ssse3");
+    f.avx2 = __builtin_cpu_supports("avx2");
+    f.avx512f = __builtin_cpu_supports("avx512f");
+    f.avx512bw = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    f.avx512vpopcntdq =
+        __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+    return f;
+}
+
+// The features are detected only once, the first time this function is called
+inline const Features &features()
+{
+    static const Features f = detect_features();
+    return f;
+}
+} // namespace cpu
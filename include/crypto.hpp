@@ -1,14 +1,22 @@
 #pragma once
+#include "cpu.hpp"
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <openssl/conf.h>
+#include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <ostream>
 #include <random>
 #include <stdexcept>
 #include <stdint.h>
+#include <string.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 using byte = uint8_t;
@@ -17,52 +25,429 @@ using bytes = std::vector<uint8_t>;
 // To convert hex to base64, I am going to use two different functions, hex::to_bytes and
 // base64::from_bytes
 
+namespace detail
+{
+template <typename T, bool = std::is_integral<T>::value> struct is_byte_type : std::false_type
+{
+};
+
+template <typename T>
+struct is_byte_type<T, true>
+    : std::integral_constant<bool, sizeof(T) == 1 && !std::is_same<T, bool>::value>
+{
+};
+
+template <typename Iter, typename T, bool = is_byte_type<T>::value>
+struct is_contiguous_bytes_impl : std::false_type
+{
+};
+
+template <typename Iter, typename T>
+struct is_contiguous_bytes_impl<Iter, T, true>
+    : std::integral_constant<
+          bool, std::is_pointer<Iter>::value || std::is_same<Iter, std::string::iterator>::value ||
+                    std::is_same<Iter, std::string::const_iterator>::value ||
+                    std::is_same<Iter, typename std::vector<T>::iterator>::value ||
+                    std::is_same<Iter, typename std::vector<T>::const_iterator>::value>
+{
+};
+
+// True if Iter points into contiguous storage of a byte sized integer type (pointers, std::string
+// and std::vector iterators). Such ranges are handed to the vectorized kernels directly, every
+// other iterator goes through the generic element by element loop.
+template <typename Iter>
+struct is_contiguous_bytes
+    : is_contiguous_bytes_impl<
+          Iter, typename std::remove_cv<typename std::iterator_traits<Iter>::value_type>::type>
+{
+};
+
+template <typename Iter>
+using contiguous_tag = std::integral_constant<bool, is_contiguous_bytes<Iter>::value>;
+
+template <typename Iter> inline const byte *byte_pointer(Iter it)
+{
+    return reinterpret_cast<const byte *>(std::addressof(*it));
+}
+
+template <typename Iter> inline byte *mutable_byte_pointer(Iter it)
+{
+    return reinterpret_cast<byte *>(std::addressof(*it));
+}
+
+// Passes [begin, end) to convert(data, n, last) in blocks of at most Block elements. The elements
+// of non contiguous ranges are first copied to a buffer on the stack, so nothing is allocated
+template <size_t Block, typename Iter, typename Convert>
+inline void for_each_block(Iter begin, Iter end, Convert convert, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n == 0)
+    {
+        convert(nullptr, 0, true);
+        return;
+    }
+    const byte *data = byte_pointer(begin);
+    for (; n > Block; data += Block, n -= Block)
+        convert(data, Block, false);
+    convert(data, n, true);
+}
+
+template <size_t Block, typename Iter, typename Convert>
+inline void for_each_block(Iter begin, Iter end, Convert convert, std::false_type)
+{
+    byte buffer[Block];
+    while (true)
+    {
+        size_t n = 0;
+        for (; n < Block && begin != end; ++begin)
+            buffer[n++] = static_cast<byte>(*begin);
+        bool last = begin == end;
+        convert(buffer, n, last);
+        if (last)
+            break;
+    }
+}
+
+// The output can be written directly if both ranges are contiguous
+template <typename Iter, typename OutIter>
+using direct_tag = std::integral_constant<bool, is_contiguous_bytes<Iter>::value &&
+                                                    is_contiguous_bytes<OutIter>::value>;
+} // namespace detail
+
 namespace hex
 {
 // Converts a sequence of bytes to hexadecimal
 const static byte DECODE_TABLE[] = {'0', '1', '2', '3', '4', '5', '6', '7',
                                     '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
-template <typename Iter> inline bytes from_bytes(Iter begin, Iter end)
+namespace detail
+{
+const byte INVALID = 0xff;
+
+// Maps every character to the value of the hex digit, or INVALID if it is not a hex digit.
+// A table lookup replaces the locale aware tolower / isalnum / isdigit calls
+struct ValueTable
+{
+    byte v[256];
+
+    constexpr ValueTable() : v()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            if ('0' <= i && i <= '9')
+                v[i] = static_cast<byte>(i - '0');
+            else if ('a' <= i && i <= 'f')
+                v[i] = static_cast<byte>(i - 'a' + 10);
+            else if ('A' <= i && i <= 'F')
+                v[i] = static_cast<byte>(i - 'A' + 10);
+            else
+                v[i] = INVALID;
+        }
+    }
+};
+
+constexpr ValueTable VALUE_TABLE{};
+
+[[noreturn]] inline void throw_invalid_character(byte ch)
+{
+    throw std::runtime_error("Invalid character '" +
+                             std::string(1, static_cast<char>(tolower(ch))) + "' for base-16");
+}
+
+[[noreturn]] inline void throw_invalid_length(size_t sz)
+{
+    throw std::runtime_error("Invalid length " + std::to_string(sz) + " for base-16");
+}
+
+inline byte decode_pair(byte c1, byte c2)
+{
+    byte hi = VALUE_TABLE.v[c1];
+    byte lo = VALUE_TABLE.v[c2];
+    if (hi == INVALID)
+        throw_invalid_character(c1);
+    if (lo == INVALID)
+        throw_invalid_character(c2);
+    return static_cast<byte>((hi << 4) | lo);
+}
+
+// A kernel converts as many whole blocks as it can and returns the number of units it has
+// processed. The remaining tail (or a block with an invalid character) is left to the scalar code,
+// which also produces the exceptions.
+using kernel = size_t (*)(const byte *in, size_t n, byte *out);
+
+// Decodes n pairs of hex characters into n bytes
+inline size_t decode_scalar(const byte *in, size_t n, byte *out)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = decode_pair(in[2 * i], in[2 * i + 1]);
+    return n;
+}
+
+// Encodes n bytes into 2n hex characters
+inline size_t encode_scalar(const byte *in, size_t n, byte *out)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        out[2 * i] = DECODE_TABLE[in[i] >> 4];
+        out[2 * i + 1] = DECODE_TABLE[in[i] & 0xf];
+    }
+    return n;
+}
+
+#if CRYPTO_X86_SIMD
+// The vectorized decoders classify every character as a digit ('0' <= c <= '9') or a letter
+// ('a' <= (c | 0x20) <= 'f') using unsigned compares, then merge the two nibbles of each pair with
+// a multiply-add (first * 16 + second * 1) and narrow the 16 bit results to bytes.
+
+__attribute__((target("ssse3"))) inline size_t decode_ssse3(const byte *in, size_t n, byte *out)
+{
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i a_char = _mm_set1_epi8('a');
+    const __m128i lower_case = _mm_set1_epi8(0x20);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i weights = _mm_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2 * i));
+        __m128i d = _mm_sub_epi8(c, zero_char);
+        __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine), d);
+        __m128i a = _mm_sub_epi8(_mm_or_si128(c, lower_case), a_char);
+        __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(a, five), a);
+        if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff)
+            break;
+
+        __m128i v = _mm_or_si128(_mm_and_si128(is_digit, d),
+                                 _mm_and_si128(is_alpha, _mm_add_epi8(a, ten)));
+        __m128i w = _mm_maddubs_epi16(v, weights);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(w, w));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t decode_avx2(const byte *in, size_t n, byte *out)
+{
+    const __m256i zero_char = _mm256_set1_epi8('0');
+    const __m256i a_char = _mm256_set1_epi8('a');
+    const __m256i lower_case = _mm256_set1_epi8(0x20);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 2 * i));
+        __m256i d = _mm256_sub_epi8(c, zero_char);
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d);
+        __m256i a = _mm256_sub_epi8(_mm256_or_si256(c, lower_case), a_char);
+        __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(a, five), a);
+        if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha)) != -1)
+            break;
+
+        __m256i v = _mm256_or_si256(_mm256_and_si256(is_digit, d),
+                                    _mm256_and_si256(is_alpha, _mm256_add_epi8(a, ten)));
+        __m256i w = _mm256_maddubs_epi16(v, weights);
+        // packus works within each 128 bit lane, gather the low quadword of both lanes
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(w, w), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm256_castsi256_si128(p));
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline size_t decode_avx512(const byte *in, size_t n,
+                                                                        byte *out)
+{
+    const __m512i zero_char = _mm512_set1_epi8('0');
+    const __m512i a_char = _mm512_set1_epi8('a');
+    const __m512i lower_case = _mm512_set1_epi8(0x20);
+    const __m512i nine = _mm512_set1_epi8(9);
+    const __m512i five = _mm512_set1_epi8(5);
+    const __m512i ten = _mm512_set1_epi8(10);
+    const __m512i weights = _mm512_set1_epi16(0x0110);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m512i c = _mm512_loadu_si512(in + 2 * i);
+        __m512i d = _mm512_sub_epi8(c, zero_char);
+        __mmask64 is_digit = _mm512_cmple_epu8_mask(d, nine);
+        __m512i a = _mm512_sub_epi8(_mm512_or_si512(c, lower_case), a_char);
+        __mmask64 is_alpha = _mm512_cmple_epu8_mask(a, five);
+        if ((is_digit | is_alpha) != ~static_cast<__mmask64>(0))
+            break;
+
+        __m512i v = _mm512_mask_blend_epi8(is_alpha, d, _mm512_add_epi8(a, ten));
+        __m512i w = _mm512_maddubs_epi16(v, weights);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm512_cvtepi16_epi8(w));
+    }
+    return i;
+}
+
+// The vectorized encoders split every byte into its two nibbles and translate them with a 16
+// entry shuffle table.
+
+__attribute__((target("ssse3"))) inline size_t encode_ssse3(const byte *in, size_t n, byte *out)
+{
+    const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i *>(DECODE_TABLE));
+    const __m128i low_nibble = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(x, 4), low_nibble));
+        __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(x, low_nibble));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i + 16),
+                         _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t encode_avx2(const byte *in, size_t n, byte *out)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(DECODE_TABLE)));
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+        __m256i hi =
+            _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibble));
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(x, low_nibble));
+        // The unpacks interleave within each 128 bit lane: [0-7 | 16-23] and [8-15 | 24-31]
+        __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i),
+                            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i + 32),
+                            _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline size_t encode_avx512(const byte *in, size_t n,
+                                                                        byte *out)
+{
+    const __m512i table = _mm512_broadcast_i32x4(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(DECODE_TABLE)));
+    const __m512i low_nibble = _mm512_set1_epi16(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        // Widen every byte to 16 bits, then place the high nibble in the low byte and the low
+        // nibble in the high byte, so that a single shuffle produces the characters in order
+        __m512i w =
+            _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i)));
+        __m512i idx = _mm512_or_si512(_mm512_srli_epi16(w, 4),
+                                      _mm512_slli_epi16(_mm512_and_si512(w, low_nibble), 8));
+        _mm512_storeu_si512(out + 2 * i, _mm512_shuffle_epi8(table, idx));
+    }
+    return i;
+}
+#endif
+
+inline kernel select_decode_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx512bw)
+        return decode_avx512;
+    if (cpu::features().avx2)
+        return decode_avx2;
+    if (cpu::features().ssse3)
+        return decode_ssse3;
+#endif
+    return decode_scalar;
+}
+
+inline kernel select_encode_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx512bw)
+        return encode_avx512;
+    if (cpu::features().avx2)
+        return encode_avx2;
+    if (cpu::features().ssse3)
+        return encode_ssse3;
+#endif
+    return encode_scalar;
+}
+
+// Decodes n hex characters into n / 2 bytes, throws if a character is invalid or n is odd
+inline void decode(const byte *in, size_t n, byte *out)
+{
+    static const kernel fast = select_decode_kernel();
+    size_t pairs = n / 2;
+    size_t done = fast(in, pairs, out);
+    decode_scalar(in + 2 * done, pairs - done, out + done);
+    if (n % 2 != 0)
+    {
+        // Report a bad last character before the length, just like the iterator version
+        if (VALUE_TABLE.v[in[n - 1]] == INVALID)
+            throw_invalid_character(in[n - 1]);
+        throw_invalid_length(n);
+    }
+}
+
+// Encodes n bytes into 2n hex characters
+inline void encode(const byte *in, size_t n, byte *out)
+{
+    static const kernel fast = select_encode_kernel();
+    size_t done = fast(in, n, out);
+    encode_scalar(in + done, n - done, out + 2 * done);
+}
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end, std::true_type)
+{
+    bytes result(2 * static_cast<size_t>(std::distance(begin, end)));
+    if (!result.empty())
+        encode(::detail::byte_pointer(begin), result.size() / 2, &result[0]);
+    return result;
+}
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end, std::false_type)
 {
     bytes result;
     for (; begin != end; begin++)
     {
-        result.push_back(DECODE_TABLE[(*begin) >> 4]);
-        result.push_back(DECODE_TABLE[(*begin) & 0xf]);
+        auto b = static_cast<byte>(*begin);
+        result.push_back(DECODE_TABLE[b >> 4]);
+        result.push_back(DECODE_TABLE[b & 0xf]);
     }
     return result;
 }
 
-template <typename T> inline bytes from_bytes(const T &t)
+template <typename Iter> inline bytes to_bytes(Iter begin, Iter end, std::true_type)
 {
-    return from_bytes(std::begin(t), std::end(t));
+    size_t sz = static_cast<size_t>(std::distance(begin, end));
+    bytes decoded(sz / 2);
+    if (sz != 0)
+        decode(::detail::byte_pointer(begin), sz, decoded.data());
+    return decoded;
 }
 
-// This function converts a hex string from [begin, end)
-template <typename Iter> inline bytes to_bytes(const Iter begin, const Iter end)
+template <typename Iter> inline bytes to_bytes(Iter begin, Iter end, std::false_type)
 {
     bytes decoded;
     size_t sz = 0;
     byte b = 0;
 
-    // The input string is empty
-    if (begin == end)
-        return decoded;
-
     for (auto it = begin; it != end; it++)
     {
-        auto ch = static_cast<byte>(tolower(*it));
-        if (!isalnum(ch))
-        {
-            throw std::runtime_error("Invalid character '" + std::string(1, ch) + "' for base-16");
-        }
+        auto ch = static_cast<byte>(*it);
+        byte value = VALUE_TABLE.v[ch];
+        if (value == INVALID)
+            throw_invalid_character(ch);
 
-        b <<= 4;
-        if (isdigit(ch))
-            b |= static_cast<uint8_t>(ch - '0');
-        else
-            b |= static_cast<uint8_t>(ch - 'a' + 10);
+        b = static_cast<byte>((b << 4) | value);
 
         // At every odd index, i.e. 1, 3, 5 ..., add the byte to decoded vector
         if (sz % 2 != 0)
@@ -75,11 +460,95 @@ template <typename Iter> inline bytes to_bytes(const Iter begin, const Iter end)
     if (sz % 2 != 0)
     {
         // Hex strings should always be of even length
-        throw std::runtime_error("Invalid length " + std::to_string(sz) + " for base-16");
+        throw_invalid_length(sz);
     }
     return decoded;
 }
 
+// Number of bytes converted at a time when writing through an output iterator
+const size_t BLOCK_SIZE = 2048;
+
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n != 0)
+        encode(::detail::byte_pointer(begin), n, ::detail::mutable_byte_pointer(out));
+    return out + static_cast<std::ptrdiff_t>(2 * n);
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out, std::false_type)
+{
+    ::detail::for_each_block<BLOCK_SIZE>(
+        begin, end,
+        [&out](const byte *in, size_t n, bool) {
+            byte buffer[2 * BLOCK_SIZE];
+            encode(in, n, buffer);
+            out = std::copy(buffer, buffer + 2 * n, out);
+        },
+        ::detail::contiguous_tag<Iter>());
+    return out;
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n != 0)
+        decode(::detail::byte_pointer(begin), n,
+               n >= 2 ? ::detail::mutable_byte_pointer(out) : nullptr);
+    return out + static_cast<std::ptrdiff_t>(n / 2);
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out, std::false_type)
+{
+    ::detail::for_each_block<BLOCK_SIZE>(
+        begin, end,
+        [&out](const byte *in, size_t n, bool) {
+            byte buffer[BLOCK_SIZE / 2];
+            decode(in, n, buffer);
+            out = std::copy(buffer, buffer + n / 2, out);
+        },
+        ::detail::contiguous_tag<Iter>());
+    return out;
+}
+} // namespace detail
+
+// Number of characters that n bytes are encoded to
+inline size_t encoded_size(size_t n) { return 2 * n; }
+
+// Number of bytes that n characters are decoded to
+inline size_t decoded_size(size_t n) { return n / 2; }
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end)
+{
+    return detail::from_bytes(begin, end, ::detail::contiguous_tag<Iter>());
+}
+
+template <typename T> inline bytes from_bytes(const T &t)
+{
+    return from_bytes(std::begin(t), std::end(t));
+}
+
+// Writes the hex encoding of [begin, end) to out, and returns the end of the output.
+// out may be a pointer or iterator into a buffer of encoded_size() bytes, or an output iterator
+// such as std::back_inserter. No memory is allocated, so a single buffer can be reused
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out)
+{
+    return detail::from_bytes(begin, end, out, ::detail::direct_tag<Iter, OutIter>());
+}
+
+// This function converts a hex string from [begin, end)
+// Contiguous ranges of characters (std::string, bytes, pointers) are converted by the widest
+// SIMD kernel that the CPU supports, everything else falls back to a scalar loop
+template <typename Iter> inline bytes to_bytes(const Iter begin, const Iter end)
+{
+    return detail::to_bytes(begin, end, ::detail::contiguous_tag<Iter>());
+}
+
 // Note: Don't use it directly with raw string literals (const char*) since the terminating null
 // character is also considered
 template <typename T> inline bytes to_bytes(const T &t)
@@ -87,6 +556,14 @@ template <typename T> inline bytes to_bytes(const T &t)
     return to_bytes(std::begin(t), std::end(t));
 }
 
+// Writes the bytes decoded from [begin, end) to out, and returns the end of the output.
+// As with from_bytes, out may point into a buffer of decoded_size() bytes or be an output iterator
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out)
+{
+    return detail::to_bytes(begin, end, out, ::detail::direct_tag<Iter, OutIter>());
+}
+
 } // namespace hex
 
 namespace base64
@@ -98,7 +575,376 @@ const static byte ENCODE_TABLE[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I',
                                     'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
                                     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'};
 
-template <typename Iter> inline bytes from_bytes(Iter begin, Iter end)
+namespace detail
+{
+const byte INVALID = 0xff;
+
+// Maps every character of the alphabet to its 6 bit value, everything else (including the padding
+// character) to INVALID
+struct ValueTable
+{
+    byte v[256];
+
+    constexpr ValueTable() : v()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            if ('A' <= i && i <= 'Z')
+                v[i] = static_cast<byte>(i - 'A');
+            else if ('a' <= i && i <= 'z')
+                v[i] = static_cast<byte>(i - 'a' + 26);
+            else if ('0' <= i && i <= '9')
+                v[i] = static_cast<byte>(i - '0' + 52);
+            else if (i == '+')
+                v[i] = 62;
+            else if (i == '/')
+                v[i] = 63;
+            else
+                v[i] = INVALID;
+        }
+    }
+};
+
+constexpr ValueTable VALUE_TABLE{};
+
+[[noreturn]] inline void throw_invalid_character(byte ch)
+{
+    throw std::runtime_error("Invalid character '" + std::string(1, static_cast<char>(ch)) +
+                             "' for base-64");
+}
+
+[[noreturn]] inline void throw_invalid_length(size_t sz)
+{
+    throw std::runtime_error("Invalid length " + std::to_string(sz) + " for base-64");
+}
+
+[[noreturn]] inline void throw_invalid_padding()
+{
+    throw std::runtime_error("Invalid padding for base-64");
+}
+
+// As with hex, a kernel converts as many whole groups as it can and returns how many it has
+// processed, the scalar code finishes the rest and reports errors
+using kernel = size_t (*)(const byte *in, size_t n, byte *out);
+
+inline byte value_of(byte ch)
+{
+    byte v = VALUE_TABLE.v[ch];
+    if (v == INVALID)
+        throw_invalid_character(ch);
+    return v;
+}
+
+// Decodes n groups of four characters into n groups of three bytes
+inline size_t decode_scalar(const byte *in, size_t n, byte *out)
+{
+    for (size_t i = 0; i < n; i++, in += 4, out += 3)
+    {
+        uint32_t v = static_cast<uint32_t>(value_of(in[0])) << 18 |
+                     static_cast<uint32_t>(value_of(in[1])) << 12 |
+                     static_cast<uint32_t>(value_of(in[2])) << 6 | value_of(in[3]);
+        out[0] = static_cast<byte>(v >> 16);
+        out[1] = static_cast<byte>(v >> 8);
+        out[2] = static_cast<byte>(v);
+    }
+    return n;
+}
+
+// Encodes n groups of three bytes into n groups of four characters
+inline size_t encode_scalar(const byte *in, size_t n, byte *out)
+{
+    for (size_t i = 0; i < n; i++, in += 3, out += 4)
+    {
+        out[0] = ENCODE_TABLE[in[0] >> 2];
+        out[1] = ENCODE_TABLE[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+        out[2] = ENCODE_TABLE[((in[1] & 0xf) << 2) | (in[2] >> 6)];
+        out[3] = ENCODE_TABLE[in[2] & 0x3f];
+    }
+    return n;
+}
+
+#if CRYPTO_X86_SIMD
+// The encoders follow Wojciech Muła's scheme: a shuffle places the three bytes of every group in
+// a 32 bit lane, two multiplies move the four 6 bit fields into separate bytes, and the fields
+// are translated to ASCII by adding an offset looked up with a shuffle.
+
+__attribute__((target("ssse3"))) inline __m128i encode_lane_ssse3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t0, t1);
+
+    // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i offsets =
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, reduced));
+}
+
+__attribute__((target("avx2"))) inline __m256i encode_lane_avx2(__m256i in)
+{
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0,
+                                                 1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2,
+                                                 0, 1));
+    __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(t0, t1);
+
+    __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    const __m256i offsets = _mm256_broadcastsi128_si256(
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+    return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, reduced));
+}
+
+// 12 bytes -> 16 characters per step. Every load reads 16 bytes, so at least 6 groups must remain
+__attribute__((target("ssse3"))) inline size_t encode_ssse3(const byte *in, size_t n, byte *out)
+{
+    size_t i = 0;
+    for (; i + 6 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 3 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * i), encode_lane_ssse3(x));
+    }
+    return i;
+}
+
+// 24 bytes -> 32 characters per step, 12 bytes in each 128 bit lane
+__attribute__((target("avx2"))) inline size_t encode_avx2(const byte *in, size_t n, byte *out)
+{
+    size_t i = 0;
+    for (; i + 10 <= n; i += 8)
+    {
+        const byte *p = in + 3 * i;
+        __m256i x = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 12)), 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 4 * i), encode_lane_avx2(x));
+    }
+    return i;
+}
+
+// The decoders classify every character into one of the five ranges of the alphabet with
+// unsigned compares and add the offset of its range. Two multiply-adds then merge the four 6 bit
+// values of every group into 24 bits, and a shuffle packs the three bytes of each group.
+
+__attribute__((target("ssse3"))) inline bool decode_lane_ssse3(__m128i c, __m128i &out)
+{
+    __m128i upper = _mm_sub_epi8(c, _mm_set1_epi8('A'));
+    __m128i lower = _mm_sub_epi8(c, _mm_set1_epi8('a'));
+    __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i is_upper = _mm_cmpeq_epi8(_mm_min_epu8(upper, _mm_set1_epi8(25)), upper);
+    __m128i is_lower = _mm_cmpeq_epi8(_mm_min_epu8(lower, _mm_set1_epi8(25)), lower);
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i is_plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i is_slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+    __m128i valid = _mm_or_si128(_mm_or_si128(is_upper, is_lower),
+                                 _mm_or_si128(is_digit, _mm_or_si128(is_plus, is_slash)));
+    if (_mm_movemask_epi8(valid) != 0xffff)
+        return false;
+
+    __m128i v = _mm_and_si128(is_upper, upper);
+    v = _mm_or_si128(v, _mm_and_si128(is_lower, _mm_add_epi8(lower, _mm_set1_epi8(26))));
+    v = _mm_or_si128(v, _mm_and_si128(is_digit, _mm_add_epi8(digit, _mm_set1_epi8(52))));
+    v = _mm_or_si128(v, _mm_and_si128(is_plus, _mm_set1_epi8(62)));
+    v = _mm_or_si128(v, _mm_and_si128(is_slash, _mm_set1_epi8(63)));
+
+    // [a, b, c, d] -> [a * 64 + b, c * 64 + d] -> (a * 64 + b) * 4096 + c * 64 + d
+    __m128i merged = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(merged,
+                           _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+// 16 characters -> 12 bytes per step
+__attribute__((target("ssse3"))) inline size_t decode_ssse3(const byte *in, size_t n, byte *out)
+{
+    size_t i = 0;
+    __m128i decoded;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 4 * i));
+        if (!decode_lane_ssse3(c, decoded))
+            break;
+        // Write exactly 12 bytes so that the caller's buffer does not need any slack
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3 * i), decoded);
+        uint32_t last = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(decoded, 8)));
+        memcpy(out + 3 * i + 8, &last, 4);
+    }
+    return i;
+}
+
+// 32 characters -> 24 bytes per step
+__attribute__((target("avx2"))) inline size_t decode_avx2(const byte *in, size_t n, byte *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 4 * i));
+        __m256i upper = _mm256_sub_epi8(c, _mm256_set1_epi8('A'));
+        __m256i lower = _mm256_sub_epi8(c, _mm256_set1_epi8('a'));
+        __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+        __m256i is_upper = _mm256_cmpeq_epi8(_mm256_min_epu8(upper, _mm256_set1_epi8(25)), upper);
+        __m256i is_lower = _mm256_cmpeq_epi8(_mm256_min_epu8(lower, _mm256_set1_epi8(25)), lower);
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+        __m256i is_plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+        __m256i is_slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+
+        __m256i valid =
+            _mm256_or_si256(_mm256_or_si256(is_upper, is_lower),
+                            _mm256_or_si256(is_digit, _mm256_or_si256(is_plus, is_slash)));
+        if (_mm256_movemask_epi8(valid) != -1)
+            break;
+
+        __m256i v = _mm256_and_si256(is_upper, upper);
+        v = _mm256_or_si256(
+            v, _mm256_and_si256(is_lower, _mm256_add_epi8(lower, _mm256_set1_epi8(26))));
+        v = _mm256_or_si256(
+            v, _mm256_and_si256(is_digit, _mm256_add_epi8(digit, _mm256_set1_epi8(52))));
+        v = _mm256_or_si256(v, _mm256_and_si256(is_plus, _mm256_set1_epi8(62)));
+        v = _mm256_or_si256(v, _mm256_and_si256(is_slash, _mm256_set1_epi8(63)));
+
+        __m256i merged = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(
+            merged, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1,
+                                     0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // Each lane holds 12 bytes, move them next to each other
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 3 * i),
+                         _mm256_castsi256_si128(merged));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3 * i + 16),
+                         _mm256_extracti128_si256(merged, 1));
+    }
+    return i;
+}
+#endif
+
+inline kernel select_decode_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx2)
+        return decode_avx2;
+    if (cpu::features().ssse3)
+        return decode_ssse3;
+#endif
+    return decode_scalar;
+}
+
+inline kernel select_encode_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx2)
+        return encode_avx2;
+    if (cpu::features().ssse3)
+        return encode_ssse3;
+#endif
+    return encode_scalar;
+}
+
+// Number of bytes that n characters of base64 decode to, given the last two characters. Throws if
+// the length or the padding is invalid
+inline size_t decoded_length(size_t n, byte second_last, byte last)
+{
+    if (n % 4 != 0)
+        throw_invalid_length(n);
+    if (n == 0)
+        return 0;
+    if (last != '=' && second_last == '=')
+        throw_invalid_padding();
+    return n / 4 * 3 - (last == '=') - (second_last == '=');
+}
+
+inline size_t decoded_length(const byte *in, size_t n)
+{
+    return n < 2 ? decoded_length(n, 0, 0) : decoded_length(n, in[n - 2], in[n - 1]);
+}
+
+// Decodes n characters into decoded_length(in, n) bytes
+inline void decode(const byte *in, size_t n, byte *out)
+{
+    static const kernel fast = select_decode_kernel();
+    size_t length = decoded_length(in, n);
+    if (n == 0)
+        return;
+
+    // Every group except the last one is complete
+    size_t groups = n / 4 - 1;
+    size_t done = fast(in, groups, out);
+    decode_scalar(in + 4 * done, groups - done, out + 3 * done);
+
+    const byte *last = in + 4 * groups;
+    byte *dest = out + 3 * groups;
+    byte v0 = value_of(last[0]), v1 = value_of(last[1]);
+    dest[0] = static_cast<byte>((v0 << 2) | (v1 >> 4));
+    if (length % 3 == 1)
+    {
+        // "xx==", the unused bits of the second character must be zero
+        if ((v1 & 0xf) != 0)
+            throw_invalid_padding();
+        return;
+    }
+    byte v2 = value_of(last[2]);
+    dest[1] = static_cast<byte>(((v1 & 0xf) << 4) | (v2 >> 2));
+    if (length % 3 == 2)
+    {
+        // "xxx="
+        if ((v2 & 0x3) != 0)
+            throw_invalid_padding();
+        return;
+    }
+    byte v3 = value_of(last[3]);
+    dest[2] = static_cast<byte>(((v2 & 0x3) << 6) | v3);
+}
+
+// Encodes n bytes into 4 * ceil(n / 3) characters
+inline void encode(const byte *in, size_t n, byte *out)
+{
+    static const kernel fast = select_encode_kernel();
+    size_t groups = n / 3;
+    size_t done = fast(in, groups, out);
+    encode_scalar(in + 3 * done, groups - done, out + 4 * done);
+
+    in += 3 * groups;
+    out += 4 * groups;
+    if (n % 3 == 1)
+    {
+        out[0] = ENCODE_TABLE[in[0] >> 2];
+        out[1] = ENCODE_TABLE[(in[0] & 0x3) << 4];
+        out[2] = '=';
+        out[3] = '=';
+    }
+    else if (n % 3 == 2)
+    {
+        out[0] = ENCODE_TABLE[in[0] >> 2];
+        out[1] = ENCODE_TABLE[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+        out[2] = ENCODE_TABLE[(in[1] & 0xf) << 2];
+        out[3] = '=';
+    }
+}
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    bytes encoded((n + 2) / 3 * 4);
+    if (n != 0)
+        encode(::detail::byte_pointer(begin), n, encoded.data());
+    return encoded;
+}
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end, std::false_type)
 {
     bytes encoded;
 
@@ -145,10 +991,142 @@ template <typename Iter> inline bytes from_bytes(Iter begin, Iter end)
     return encoded;
 }
 
+template <typename Iter> inline bytes to_bytes(Iter begin, Iter end, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n == 0)
+        return bytes();
+    const byte *in = ::detail::byte_pointer(begin);
+    bytes decoded(decoded_length(in, n));
+    decode(in, n, decoded.data());
+    return decoded;
+}
+
+// A multiple of both three and four, so that only the last block can be padded
+const size_t BLOCK_SIZE = 3072;
+
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n != 0)
+        encode(::detail::byte_pointer(begin), n, ::detail::mutable_byte_pointer(out));
+    return out + static_cast<std::ptrdiff_t>((n + 2) / 3 * 4);
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out, std::false_type)
+{
+    ::detail::for_each_block<BLOCK_SIZE>(
+        begin, end,
+        [&out](const byte *in, size_t n, bool) {
+            byte buffer[BLOCK_SIZE / 3 * 4];
+            encode(in, n, buffer);
+            out = std::copy(buffer, buffer + (n + 2) / 3 * 4, out);
+        },
+        ::detail::contiguous_tag<Iter>());
+    return out;
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out, std::true_type)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n == 0)
+        return out;
+    const byte *in = ::detail::byte_pointer(begin);
+    size_t length = decoded_length(in, n);
+    decode(in, n, length != 0 ? ::detail::mutable_byte_pointer(out) : nullptr);
+    return out + static_cast<std::ptrdiff_t>(length);
+}
+
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out, std::false_type)
+{
+    ::detail::for_each_block<BLOCK_SIZE>(
+        begin, end,
+        [&out](const byte *in, size_t n, bool last) {
+            // Padding is only allowed at the very end
+            if (!last && in[n - 1] == '=')
+                throw_invalid_padding();
+            byte buffer[BLOCK_SIZE / 4 * 3];
+            size_t length = decoded_length(in, n);
+            decode(in, n, buffer);
+            out = std::copy(buffer, buffer + length, out);
+        },
+        ::detail::contiguous_tag<Iter>());
+    return out;
+}
+
+template <typename Iter> inline bytes to_bytes(Iter begin, Iter end, std::false_type)
+{
+    bytes decoded;
+    to_bytes(begin, end, std::back_inserter(decoded), std::false_type());
+    return decoded;
+}
+} // namespace detail
+
+// Number of characters that n bytes are encoded to
+inline size_t encoded_size(size_t n) { return (n + 2) / 3 * 4; }
+
+// Upper bound on the number of bytes that n characters are decoded to
+inline size_t max_decoded_size(size_t n) { return n / 4 * 3; }
+
+// Exact number of bytes that [begin, end) is decoded to, this depends on the padding at the end.
+// Throws if the length or padding is invalid
+template <typename Iter> inline size_t decoded_size(Iter begin, Iter end)
+{
+    size_t n = static_cast<size_t>(std::distance(begin, end));
+    if (n < 2)
+        return detail::decoded_length(n, 0, 0);
+    auto second_last = std::next(begin, static_cast<std::ptrdiff_t>(n - 2));
+    auto last = std::next(second_last);
+    return detail::decoded_length(n, static_cast<byte>(*second_last), static_cast<byte>(*last));
+}
+
+template <typename T> inline size_t decoded_size(const T &t)
+{
+    return decoded_size(std::begin(t), std::end(t));
+}
+
+template <typename Iter> inline bytes from_bytes(Iter begin, Iter end)
+{
+    return detail::from_bytes(begin, end, ::detail::contiguous_tag<Iter>());
+}
+
 template <typename T> inline bytes from_bytes(const T &t)
 {
     return from_bytes(std::begin(t), std::end(t));
 }
+
+// Writes the base64 encoding of [begin, end) to out, and returns the end of the output.
+// out may point into a buffer of encoded_size() bytes, or be an output iterator
+template <typename Iter, typename OutIter>
+inline OutIter from_bytes(Iter begin, Iter end, OutIter out)
+{
+    return detail::from_bytes(begin, end, out, ::detail::direct_tag<Iter, OutIter>());
+}
+
+// Decodes base64 (standard alphabet, with padding) from [begin, end). The length must be a
+// multiple of four, and '=' may only appear as padding at the end
+template <typename Iter> inline bytes to_bytes(Iter begin, Iter end)
+{
+    return detail::to_bytes(begin, end, ::detail::contiguous_tag<Iter>());
+}
+
+// Note: As with hex::to_bytes, the terminating null of raw string literals is also considered
+template <typename T> inline bytes to_bytes(const T &t)
+{
+    return to_bytes(std::begin(t), std::end(t));
+}
+
+// Writes the bytes decoded from [begin, end) to out, and returns the end of the output.
+// out may point into a buffer of decoded_size() bytes, or be an output iterator
+template <typename Iter, typename OutIter>
+inline OutIter to_bytes(Iter begin, Iter end, OutIter out)
+{
+    return detail::to_bytes(begin, end, out, ::detail::direct_tag<Iter, OutIter>());
+}
 } // namespace base64
 
 // Convenience function to display bytes, displays non printable characters using the \x notation
@@ -187,265 +1165,885 @@ inline std::ostream &operator<<(std::ostream &os, const bytes &bytestr)
     return os;
 }
 
-// Pads the input using the PKCS#7 Scheme, the returned bytes has a size which is a mutliple of
-// block size.
-// Even if the text length is an exact multiple of block size, padding is still applied
-inline bytes pad_pkcs7(const bytes &text, int block_size)
+// Size of n bytes once padded with PKCS#7, always a bit more than n
+inline size_t pkcs7_padded_size(size_t n, size_t block_size)
+{
+    return n + block_size - n % block_size;
+}
+
+// Writes the padding of n bytes of text right after them, the buffer must hold
+// pkcs7_padded_size(n, block_size) bytes. Returns the padded size
+inline size_t pad_pkcs7_into(byte *text, size_t n, size_t block_size)
 {
     if (block_size > 255)
     {
         throw std::logic_error("PKCS#7 Padding block size cannot be greater than 255 bytes");
     }
-    bytes padded_text = text;
-    int n_padding_chars = block_size - (text.size() % block_size);
-    bytes temp(n_padding_chars, static_cast<byte>(n_padding_chars));
-
-    padded_text.insert(padded_text.end(), temp.begin(), temp.end());
-    return padded_text;
+    size_t n_padding_chars = block_size - n % block_size;
+    memset(text + n, static_cast<int>(n_padding_chars), n_padding_chars);
+    return n + n_padding_chars;
 }
 
-inline bytes unpad_pkcs7(const bytes &text, int block_size)
+// Size of a padded text without its padding, the text itself is left as it is
+inline size_t pkcs7_unpadded_size(const byte *text, size_t n, size_t block_size)
 {
     if (block_size > 255)
     {
         throw std::logic_error("PKCS#7 Padding block size cannot be greater than 255 bytes");
     }
+    if (n == 0)
+    {
+        throw std::runtime_error("Number of padding bytes > text size");
+    }
     // Get number of padding bytes
-    int padding_bytes = static_cast<int>(text.back());
-    if (padding_bytes > text.size())
+    size_t padding_bytes = text[n - 1];
+    if (padding_bytes > n)
     {
         throw std::runtime_error("Number of padding bytes > text size");
     }
-    return bytes(text.begin(), text.begin() + text.size() - padding_bytes);
+    return n - padding_bytes;
+}
+
+// Pads the input using the PKCS#7 Scheme, the returned bytes has a size which is a mutliple of
+// block size.
+// Even if the text length is an exact multiple of block size, padding is still applied
+inline bytes pad_pkcs7(const bytes &text, int block_size)
+{
+    bytes padded_text(pkcs7_padded_size(text.size(), static_cast<size_t>(block_size)));
+    std::copy(text.begin(), text.end(), padded_text.begin());
+    pad_pkcs7_into(padded_text.data(), text.size(), static_cast<size_t>(block_size));
+    return padded_text;
+}
+
+inline bytes unpad_pkcs7(const bytes &text, int block_size)
+{
+    size_t n = pkcs7_unpadded_size(text.data(), text.size(), static_cast<size_t>(block_size));
+    return bytes(text.begin(), text.begin() + static_cast<std::ptrdiff_t>(n));
+}
+
+namespace detail
+{
+// XORs n bytes of a and b into out, returns the number of bytes processed. out may be a or b
+using xor_kernel = size_t (*)(const byte *a, const byte *b, size_t n, byte *out);
+
+// One 64 bit word at a time, memcpy keeps the unaligned loads and stores well defined
+inline size_t xor_scalar(const byte *a, const byte *b, size_t n, byte *out)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        memcpy(out + i, &x, 8);
+    }
+    for (; i < n; i++)
+        out[i] = a[i] ^ b[i];
+    return n;
 }
 
-inline bytes fixed_XOR(bytes &b1, bytes &b2)
+#if CRYPTO_X86_SIMD
+__attribute__((target("avx2"))) inline size_t xor_avx2(const byte *a, const byte *b, size_t n,
+                                                       byte *out)
 {
-    if (b1.size() != b2.size())
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
     {
-        throw std::logic_error("Buffers are not of equal size");
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_xor_si256(x, y));
     }
-    auto b1_iter = b1.begin();
-    auto b2_iter = b2.begin();
-    bytes result;
-    for (; b1_iter != b1.end() && b2_iter != b2.end(); ++b1_iter, ++b2_iter)
+    return i;
+}
+
+__attribute__((target("avx512f"))) inline size_t xor_avx512(const byte *a, const byte *b, size_t n,
+                                                            byte *out)
+{
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
     {
-        result.push_back(*b1_iter ^ *b2_iter);
+        __m512i x = _mm512_loadu_si512(a + i);
+        __m512i y = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(out + i, _mm512_xor_si512(x, y));
     }
-    return result;
+    return i;
 }
+#endif
 
-inline void handleErrors(void)
+inline xor_kernel select_xor_kernel()
 {
-    ERR_print_errors_fp(stderr);
-    abort();
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx512f)
+        return xor_avx512;
+    if (cpu::features().avx2)
+        return xor_avx2;
+#endif
+    return xor_scalar;
 }
 
-inline bytes aes128_encrypt_cbc(const bytes &unpadded_plaintext, const bytes &key, const bytes &iv)
+// out[i] = a[i] ^ b[i] for i in [0, n), out may be a or b
+inline void xor_bytes(const byte *a, const byte *b, size_t n, byte *out)
 {
-    if (key.size() != 16)
-    {
-        throw std::logic_error("AES-128 Requires a key size of 16 bytes");
-    }
-    if (iv.size() != 16)
+    static const xor_kernel fast = select_xor_kernel();
+    size_t done = fast(a, b, n, out);
+    xor_scalar(a + done, b + done, n - done, out + done);
+}
+
+// Pointer to the data of a container of contiguous bytes (std::string, bytes, std::array ...)
+template <typename T> inline const byte *container_data(const T &t)
+{
+    static_assert(is_contiguous_bytes<decltype(std::begin(t))>::value,
+                  "Expected a container of contiguous bytes");
+    return std::begin(t) == std::end(t) ? nullptr : byte_pointer(std::begin(t));
+}
+
+template <typename T> inline byte *mutable_container_data(T &t)
+{
+    static_assert(is_contiguous_bytes<decltype(std::begin(t))>::value,
+                  "Expected a container of contiguous bytes");
+    return std::begin(t) == std::end(t) ? nullptr : mutable_byte_pointer(std::begin(t));
+}
+
+template <typename A, typename B> inline size_t checked_xor_size(const A &a, const B &b)
+{
+    size_t n = static_cast<size_t>(std::distance(std::begin(a), std::end(a)));
+    if (n != static_cast<size_t>(std::distance(std::begin(b), std::end(b))))
     {
-        throw std::logic_error("AES-128 Requires an iv size of 16 bytes");
+        throw std::logic_error("Buffers are not of equal size");
     }
+    return n;
+}
+} // namespace detail
+
+// Returns a ^ b. Both must be containers of contiguous bytes of the same size
+template <typename A, typename B> inline bytes fixed_XOR(const A &a, const B &b)
+{
+    size_t n = detail::checked_xor_size(a, b);
+    bytes result(n);
+    if (n != 0)
+        detail::xor_bytes(detail::container_data(a), detail::container_data(b), n, result.data());
+    return result;
+}
 
-    // Pad the plaintext to make its size a multiple of 16
-    bytes plaintext = pad_pkcs7(unpadded_plaintext, 16);
-    bytes current_iv = iv;
+// Writes a ^ b to out, which must already have the same size as a and b. out may be a or b
+template <typename A, typename B, typename Out>
+inline void fixed_XOR(const A &a, const B &b, Out &out)
+{
+    size_t n = detail::checked_xor_size(a, b);
+    detail::checked_xor_size(a, out);
+    if (n != 0)
+        detail::xor_bytes(detail::container_data(a), detail::container_data(b), n,
+                          detail::mutable_container_data(out));
+}
 
-    bytes ciphertext_full;
+// dst ^= src, without allocating
+template <typename Dst, typename Src> inline void fixed_XOR_inplace(Dst &dst, const Src &src)
+{
+    fixed_XOR(dst, src, dst);
+}
 
-    // https://wiki.openssl.org/index.php/EVP_Symmetric_Encryption_and_Decryption
-    EVP_CIPHER_CTX *ctx;
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+// XORs data with a repeating key. The key is expanded once into a buffer whose period is a
+// multiple of both the key length and the widest vector (64 bytes), so every register can be
+// XORed with an unaligned load from the expanded key at the current phase. The phase is kept
+// between calls, so a stream split into chunks of any size gives the same result as one call.
+// Has the same interface as the incremental codecs of stream.hpp
+class RepeatingKeyXOR
+{
+  public:
+    template <typename Iter> RepeatingKeyXOR(Iter begin, Iter end)
+    {
+        bytes key(begin, end);
+        if (key.empty())
+            throw std::logic_error("Key cannot be empty");
+        key_size_ = key.size();
+
+        // Small keys are repeated up to a few KB, so that xor_bytes works on long runs
+        size_t period = lcm(key_size_, 64);
+        if (period > MAX_EXPANSION)
+            period = key_size_;
+        span_ = period * std::max<size_t>(1, MIN_SPAN / period);
+        expanded_.resize(2 * span_);
+        for (size_t i = 0; i < expanded_.size(); i++)
+            expanded_[i] = key[i % key_size_];
+    }
 
-    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, &key[0], NULL))
+    template <typename Key>
+    explicit RepeatingKeyXOR(const Key &key) : RepeatingKeyXOR(std::begin(key), std::end(key))
     {
-        handleErrors();
     }
 
-    // Do not ask openssl to pad the input, since we are doing it manually
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    size_t key_size() const { return key_size_; }
+
+    // Position in the key of the next byte
+    size_t phase() const { return phase_ % key_size_; }
 
-    unsigned char ciphertext[17] = {0};
-    int len;
+    void seek(size_t phase) { phase_ = phase % key_size_; }
 
-    for (int offset = 0; offset < plaintext.size(); offset += 16)
+    size_t max_output_size(size_t n) const { return n; }
+
+    // XORs n bytes of in into out, which may be in itself
+    size_t update(const byte *in, size_t n, byte *out)
     {
-        // XOR the block with the previous ciphertext / iv if it is the first block
+        for (size_t done = 0; done < n;)
+        {
+            size_t m = std::min(n - done, span_);
+            detail::xor_bytes(in + done, expanded_.data() + phase_, m, out + done);
+            done += m;
+            phase_ += m;
+            if (phase_ >= span_)
+                phase_ -= span_;
+        }
+        return n;
+    }
 
-        for (int i = 0; i < 16; i++)
-            plaintext[offset + i] = plaintext[offset + i] ^ current_iv[i];
+    size_t finish(byte *) { return 0; }
 
-        if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, &plaintext[0] + offset, 16))
+  private:
+    static size_t lcm(size_t a, size_t b)
+    {
+        size_t x = a, y = b;
+        while (y != 0)
         {
-            handleErrors();
+            size_t t = x % y;
+            x = y;
+            y = t;
         }
-        ciphertext_full.insert(ciphertext_full.end(), std::begin(ciphertext),
-                               std::begin(ciphertext) + len);
-        assert(len == 16);
-        current_iv = bytes(std::begin(ciphertext), std::begin(ciphertext) + len);
+        return a / x * b;
     }
 
-    if (1 != EVP_EncryptFinal(ctx, ciphertext, &len))
-        handleErrors();
+    static const size_t MAX_EXPANSION = 1 << 16;
+    static const size_t MIN_SPAN = 1 << 12;
 
-    ciphertext_full.insert(ciphertext_full.end(), std::begin(ciphertext),
-                           std::begin(ciphertext) + len);
+    size_t key_size_ = 0;
+    // The expanded key holds two spans, the phase is always within the first
+    size_t span_ = 0;
+    size_t phase_ = 0;
+    bytes expanded_;
+};
+
+// Returns [begin, end) XORed with the repeating key [key_begin, key_end)
+template <typename Iter, typename KeyIter>
+inline bytes repeating_key_XOR(Iter begin, Iter end, KeyIter key_begin, KeyIter key_end)
+{
+    RepeatingKeyXOR engine(key_begin, key_end);
+    bytes result(begin, end);
+    engine.update(result.data(), result.size(), result.data());
+    return result;
+}
 
-    EVP_CIPHER_CTX_free(ctx);
-    return ciphertext_full;
+template <typename Text, typename Key>
+inline bytes repeating_key_XOR(const Text &text, const Key &key)
+{
+    return repeating_key_XOR(std::begin(text), std::end(text), std::begin(key), std::end(key));
 }
 
-inline bytes aes128_encrypt_ecb(const bytes &unpadded_plaintext, const bytes &key)
+inline void handleErrors(void)
+{
+    ERR_print_errors_fp(stderr);
+    abort();
+}
+
+namespace detail
+{
+struct CipherContextDeleter
+{
+    void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+};
+
+using CipherContext = std::unique_ptr<EVP_CIPHER_CTX, CipherContextDeleter>;
+
+// The contexts of one key, each one created with its key schedule the first time it is needed
+struct AesContexts
+{
+    CipherContext encrypt;
+    CipherContext decrypt;
+    // CBC encryption is serial, OpenSSL chains the blocks itself. The iv is set for every message
+    CipherContext cbc_encrypt;
+};
+
+// EVP takes int lengths, larger buffers are passed in slabs of this many bytes
+const size_t AES_MAX_UPDATE = 1 << 30;
+
+// Runs ctx over whole blocks, in as few calls as possible. out may be in
+inline void cipher_update(EVP_CIPHER_CTX *ctx, const byte *in, size_t n, byte *out, bool encrypt)
 {
-    if (key.size() != 16)
+    for (size_t offset = 0; offset < n; offset += AES_MAX_UPDATE)
     {
-        throw std::logic_error("AES-128 Requires a key size of 16 bytes");
+        int size = static_cast<int>(std::min(n - offset, AES_MAX_UPDATE));
+        int len;
+        int ok = encrypt ? EVP_EncryptUpdate(ctx, out + offset, &len, in + offset, size)
+                         : EVP_DecryptUpdate(ctx, out + offset, &len, in + offset, size);
+        if (1 != ok)
+            handleErrors();
+        assert(len == size);
     }
-    // Pad the plaintext to make its size a multiple of 16
-    bytes plaintext = pad_pkcs7(unpadded_plaintext, 16);
+}
+
+inline void check_aes_blocks(size_t n)
+{
+    if (n % 16 != 0)
+        throw std::runtime_error("AES-128 Input size is not a multiple of 16 bytes");
+}
 
-    bytes ciphertext_full;
+// Round keys of AES-128, the key itself then one for each of the 10 rounds
+const size_t AES_ROUND_KEYS = 11;
 
-    // https://wiki.openssl.org/index.php/EVP_Symmetric_Encryption_and_Decryption
-    EVP_CIPHER_CTX *ctx;
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+#if CRYPTO_X86_SIMD
+// The native backend, with the AES-NI instructions. Blocks that don't depend on each other are
+// processed 8 at a time so that the latency of AESENC / AESDEC is hidden by the other blocks. The
+// loops over the blocks and the rounds are unrolled so that the blocks stay in registers
+const size_t AESNI_LANES = 8;
+
+__attribute__((target("aes,sse2"))) inline __m128i aesni_expand_step(__m128i key,
+                                                                    __m128i generated)
+{
+    generated = _mm_shuffle_epi32(generated, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, generated);
+}
 
-    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, &key[0], NULL))
+// Writes the round keys for encryption to encrypt and those for the equivalent inverse cipher to
+// decrypt, 11 * 16 bytes each
+__attribute__((target("aes,sse2"))) inline void aesni_expand_key(const byte *key, byte *encrypt,
+                                                                 byte *decrypt)
+{
+    __m128i k[AES_ROUND_KEYS];
+    // The round constant has to be an immediate
+    k[0] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key));
+    k[1] = aesni_expand_step(k[0], _mm_aeskeygenassist_si128(k[0], 0x01));
+    k[2] = aesni_expand_step(k[1], _mm_aeskeygenassist_si128(k[1], 0x02));
+    k[3] = aesni_expand_step(k[2], _mm_aeskeygenassist_si128(k[2], 0x04));
+    k[4] = aesni_expand_step(k[3], _mm_aeskeygenassist_si128(k[3], 0x08));
+    k[5] = aesni_expand_step(k[4], _mm_aeskeygenassist_si128(k[4], 0x10));
+    k[6] = aesni_expand_step(k[5], _mm_aeskeygenassist_si128(k[5], 0x20));
+    k[7] = aesni_expand_step(k[6], _mm_aeskeygenassist_si128(k[6], 0x40));
+    k[8] = aesni_expand_step(k[7], _mm_aeskeygenassist_si128(k[7], 0x80));
+    k[9] = aesni_expand_step(k[8], _mm_aeskeygenassist_si128(k[8], 0x1b));
+    k[10] = aesni_expand_step(k[9], _mm_aeskeygenassist_si128(k[9], 0x36));
+    for (size_t r = 0; r < AES_ROUND_KEYS; r++)
     {
-        handleErrors();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(encrypt + 16 * r), k[r]);
+        // Decryption uses the keys in reverse order, InvMixColumns applied to the middle ones
+        __m128i d = k[AES_ROUND_KEYS - 1 - r];
+        if (r != 0 && r != AES_ROUND_KEYS - 1)
+            d = _mm_aesimc_si128(d);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(decrypt + 16 * r), d);
     }
+}
 
-    // Do not ask openssl to pad the input, since we are doing it manually
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+__attribute__((target("aes,sse2"))) inline void aesni_load_keys(const byte *round_keys,
+                                                                __m128i *k)
+{
+    for (size_t r = 0; r < AES_ROUND_KEYS; r++)
+        k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(round_keys + 16 * r));
+}
+
+__attribute__((target("aes,sse2"))) inline __m128i aesni_encrypt_block(const __m128i *k, __m128i b)
+{
+    b = _mm_xor_si128(b, k[0]);
+#pragma GCC unroll 9
+    for (size_t r = 1; r < AES_ROUND_KEYS - 1; r++)
+        b = _mm_aesenc_si128(b, k[r]);
+    return _mm_aesenclast_si128(b, k[AES_ROUND_KEYS - 1]);
+}
 
-    unsigned char ciphertext[17] = {0};
-    int len;
+__attribute__((target("aes,sse2"))) inline __m128i aesni_decrypt_block(const __m128i *k, __m128i b)
+{
+    b = _mm_xor_si128(b, k[0]);
+#pragma GCC unroll 9
+    for (size_t r = 1; r < AES_ROUND_KEYS - 1; r++)
+        b = _mm_aesdec_si128(b, k[r]);
+    return _mm_aesdeclast_si128(b, k[AES_ROUND_KEYS - 1]);
+}
 
-    for (int offset = 0; offset < plaintext.size(); offset += 16)
+// ECB over n bytes of whole blocks, out may be in
+__attribute__((target("aes,sse2"))) inline void aesni_encrypt_ecb(const byte *round_keys,
+                                                                  const byte *in, size_t n,
+                                                                  byte *out)
+{
+    __m128i k[AES_ROUND_KEYS];
+    aesni_load_keys(round_keys, k);
+    size_t i = 0;
+    for (; i + 16 * AESNI_LANES <= n; i += 16 * AESNI_LANES)
     {
-        if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, &plaintext[0] + offset, 16))
+        __m128i b[AESNI_LANES];
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
         {
-            handleErrors();
+            b[j] = _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16 * j)), k[0]);
+        }
+#pragma GCC unroll 9
+        for (size_t r = 1; r < AES_ROUND_KEYS - 1; r++)
+        {
+#pragma GCC unroll 8
+            for (size_t j = 0; j < AESNI_LANES; j++)
+                b[j] = _mm_aesenc_si128(b[j], k[r]);
+        }
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 16 * j),
+                             _mm_aesenclast_si128(b[j], k[AES_ROUND_KEYS - 1]));
         }
-        ciphertext_full.insert(ciphertext_full.end(), std::begin(ciphertext),
-                               std::begin(ciphertext) + len);
-        assert(len == 16);
     }
+    for (; i < n; i += 16)
+    {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), aesni_encrypt_block(k, b));
+    }
+}
 
-    if (1 != EVP_EncryptFinal(ctx, ciphertext, &len))
-        handleErrors();
-
-    ciphertext_full.insert(ciphertext_full.end(), std::begin(ciphertext),
-                           std::begin(ciphertext) + len);
+__attribute__((target("aes,sse2"))) inline void aesni_decrypt_ecb(const byte *round_keys,
+                                                                  const byte *in, size_t n,
+                                                                  byte *out)
+{
+    __m128i k[AES_ROUND_KEYS];
+    aesni_load_keys(round_keys, k);
+    size_t i = 0;
+    for (; i + 16 * AESNI_LANES <= n; i += 16 * AESNI_LANES)
+    {
+        __m128i b[AESNI_LANES];
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
+        {
+            b[j] = _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16 * j)), k[0]);
+        }
+#pragma GCC unroll 9
+        for (size_t r = 1; r < AES_ROUND_KEYS - 1; r++)
+        {
+#pragma GCC unroll 8
+            for (size_t j = 0; j < AESNI_LANES; j++)
+                b[j] = _mm_aesdec_si128(b[j], k[r]);
+        }
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 16 * j),
+                             _mm_aesdeclast_si128(b[j], k[AES_ROUND_KEYS - 1]));
+        }
+    }
+    for (; i < n; i += 16)
+    {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), aesni_decrypt_block(k, b));
+    }
+}
 
-    EVP_CIPHER_CTX_free(ctx);
-    return ciphertext_full;
+// CBC encryption is serial, every block needs the previous ciphertext
+__attribute__((target("aes,sse2"))) inline void aesni_encrypt_cbc(const byte *round_keys,
+                                                                  const byte *iv, const byte *in,
+                                                                  size_t n, byte *out)
+{
+    __m128i k[AES_ROUND_KEYS];
+    aesni_load_keys(round_keys, k);
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(iv));
+    for (size_t i = 0; i < n; i += 16)
+    {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        previous = aesni_encrypt_block(k, _mm_xor_si128(b, previous));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), previous);
+    }
 }
 
-inline bytes aes128_decrypt_cbc(const bytes &ciphertext, const bytes &key, const bytes &iv)
+// CBC decryption is as parallel as ECB. All the ciphertext blocks of a group are loaded before
+// anything is stored, so out may be in
+__attribute__((target("aes,sse2"))) inline void aesni_decrypt_cbc(const byte *round_keys,
+                                                                  const byte *iv, const byte *in,
+                                                                  size_t n, byte *out)
 {
-    if (key.size() != 16)
+    __m128i k[AES_ROUND_KEYS];
+    aesni_load_keys(round_keys, k);
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i *>(iv));
+    size_t i = 0;
+    for (; i + 16 * AESNI_LANES <= n; i += 16 * AESNI_LANES)
+    {
+        __m128i c[AESNI_LANES], b[AESNI_LANES];
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
+        {
+            c[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16 * j));
+            b[j] = _mm_xor_si128(c[j], k[0]);
+        }
+#pragma GCC unroll 9
+        for (size_t r = 1; r < AES_ROUND_KEYS - 1; r++)
+        {
+#pragma GCC unroll 8
+            for (size_t j = 0; j < AESNI_LANES; j++)
+                b[j] = _mm_aesdec_si128(b[j], k[r]);
+        }
+#pragma GCC unroll 8
+        for (size_t j = 0; j < AESNI_LANES; j++)
+        {
+            b[j] = _mm_aesdeclast_si128(b[j], k[AES_ROUND_KEYS - 1]);
+            b[j] = _mm_xor_si128(b[j], j == 0 ? previous : c[j - 1]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 16 * j), b[j]);
+        }
+        previous = c[AESNI_LANES - 1];
+    }
+    for (; i < n; i += 16)
     {
-        throw std::logic_error("AES-128 Requires a key size of 16 bytes");
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                         _mm_xor_si128(aesni_decrypt_block(k, c), previous));
+        previous = c;
     }
-    if (iv.size() != 16)
+}
+#endif
+
+} // namespace detail
+
+enum class AesBackend
+{
+    // AES-NI when the CPU has it, OpenSSL otherwise
+    automatic,
+    aesni,
+    openssl,
+};
+
+// AES-128 with a fixed key. The key schedule is computed once, instead of once per message, so
+// encrypting many small messages with the same key (like an oracle does) costs no setup. The
+// object can be used by several threads at the same time.
+//
+// With AES-NI, the round keys are expanded in the object and the blocks are encrypted inline,
+// without any call into OpenSSL. Otherwise the object keeps a pool of OpenSSL contexts, a call
+// borrows one set and gives it back, so concurrent calls never share a context. Every context
+// belongs to the object and is freed, and the key material wiped, when the object is destroyed.
+class Aes128
+{
+  public:
+    static const size_t BLOCK_SIZE = 16;
+
+    template <typename Key>
+    explicit Aes128(const Key &key, AesBackend backend = AesBackend::automatic)
     {
-        throw std::logic_error("AES-128 Requires an iv size of 16 bytes");
+        if (std::distance(std::begin(key), std::end(key)) != 16)
+            throw std::logic_error("AES-128 Requires a key size of 16 bytes");
+        std::copy(std::begin(key), std::end(key), key_);
+        aesni_ = backend == AesBackend::aesni ||
+                 (backend == AesBackend::automatic && cpu::features().aes);
+        if (aesni_ && !cpu::features().aes)
+            throw std::runtime_error("AES-NI is not supported by this CPU");
+#if CRYPTO_X86_SIMD
+        if (aesni_)
+            detail::aesni_expand_key(key_, encrypt_keys_, decrypt_keys_);
+#endif
     }
 
-    bytes current_iv = iv;
-    bytes plaintext_full;
-    unsigned char plaintext[17] = {0};
-    int len;
+    // A copy gets its own contexts
+    Aes128(const Aes128 &other) { copy_key(other); }
 
-    // Using OpenSSL ECB mode to implement CBC
-    EVP_CIPHER_CTX *ctx;
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+    Aes128 &operator=(const Aes128 &other)
+    {
+        if (this != &other)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.clear();
+            copy_key(other);
+        }
+        return *this;
+    }
 
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, &key[0], NULL))
+    ~Aes128()
     {
-        handleErrors();
+        OPENSSL_cleanse(key_, sizeof(key_));
+        OPENSSL_cleanse(encrypt_keys_, sizeof(encrypt_keys_));
+        OPENSSL_cleanse(decrypt_keys_, sizeof(decrypt_keys_));
     }
 
-    // We are handling padding manually
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    AesBackend backend() const { return aesni_ ? AesBackend::aesni : AesBackend::openssl; }
 
-    for (int offset = 0; offset < ciphertext.size(); offset += 16)
+    // Encrypts / decrypts whole blocks in ECB mode, n must be a multiple of the block size. out can
+    // be the same buffer as in
+    void encrypt_blocks(const byte *in, size_t n, byte *out) const
     {
+        detail::check_aes_blocks(n);
+#if CRYPTO_X86_SIMD
+        if (aesni_)
+        {
+            detail::aesni_encrypt_ecb(encrypt_keys_, in, n, out);
+            return;
+        }
+#endif
+        ContextLease contexts(*this);
+        detail::cipher_update(contexts.encrypt(), in, n, out, true);
+    }
 
-        if (1 != EVP_DecryptUpdate(ctx, plaintext, &len, &ciphertext[0] + offset, 16))
+    void decrypt_blocks(const byte *in, size_t n, byte *out) const
+    {
+        detail::check_aes_blocks(n);
+#if CRYPTO_X86_SIMD
+        if (aesni_)
         {
-            handleErrors();
+            detail::aesni_decrypt_ecb(decrypt_keys_, in, n, out);
+            return;
         }
-        // XOR with previous block of ciphertext / iv to get the final plaintext
-        for (int i = 0; i < 16; i++)
-            plaintext[i] = plaintext[i] ^ current_iv[i];
+#endif
+        ContextLease contexts(*this);
+        detail::cipher_update(contexts.decrypt(), in, n, out, false);
+    }
 
-        plaintext_full.insert(plaintext_full.end(), std::begin(plaintext),
-                              std::begin(plaintext) + len);
-        assert(len == 16);
-        current_iv = bytes(ciphertext.begin() + offset, ciphertext.begin() + offset + len);
+    // The *_into functions work on caller buffers, and in place when out is in. Encryption pads as
+    // it goes, out must hold pkcs7_padded_size(n) bytes and the size of the ciphertext is returned.
+    // Decryption returns the size of the plaintext, the padding being left after it in out
+    size_t encrypt_ecb_into(const byte *in, size_t n, byte *out) const
+    {
+        size_t full = n - n % BLOCK_SIZE;
+        encrypt_blocks(in, full, out);
+        byte last[BLOCK_SIZE];
+        pad_last_block(in + full, n - full, last);
+        encrypt_blocks(last, BLOCK_SIZE, out + full);
+        return full + BLOCK_SIZE;
     }
 
-    if (1 != EVP_DecryptFinal_ex(ctx, plaintext, &len))
-        handleErrors();
+    size_t decrypt_ecb_into(const byte *in, size_t n, byte *out) const
+    {
+        decrypt_blocks(in, n, out);
+        return pkcs7_unpadded_size(out, n, BLOCK_SIZE);
+    }
 
-    plaintext_full.insert(plaintext_full.end(), std::begin(plaintext), std::begin(plaintext) + len);
+    size_t encrypt_cbc_into(const byte *iv, const byte *in, size_t n, byte *out) const
+    {
+        size_t full = n - n % BLOCK_SIZE;
+        encrypt_cbc_blocks(iv, in, full, out);
+        byte last[BLOCK_SIZE];
+        pad_last_block(in + full, n - full, last);
+        encrypt_cbc_blocks(full == 0 ? iv : out + full - BLOCK_SIZE, last, BLOCK_SIZE, out + full);
+        return full + BLOCK_SIZE;
+    }
 
-    EVP_CIPHER_CTX_free(ctx);
-    return unpad_pkcs7(plaintext_full, 16);
-}
+    size_t decrypt_cbc_into(const byte *iv, const byte *in, size_t n, byte *out) const
+    {
+        decrypt_cbc_blocks(iv, in, n, out);
+        return pkcs7_unpadded_size(out, n, BLOCK_SIZE);
+    }
 
-inline bytes aes128_decrypt_ecb(const bytes &ciphertext, const bytes &key)
-{
-    if (key.size() != 16)
+    // In place in a vector, encryption only reallocates if its capacity is too small
+    void encrypt_ecb_inplace(bytes &buffer) const
+    {
+        size_t n = buffer.size();
+        buffer.resize(pkcs7_padded_size(n, BLOCK_SIZE));
+        encrypt_ecb_into(buffer.data(), n, buffer.data());
+    }
+
+    void decrypt_ecb_inplace(bytes &buffer) const
+    {
+        buffer.resize(decrypt_ecb_into(buffer.data(), buffer.size(), buffer.data()));
+    }
+
+    void encrypt_cbc_inplace(bytes &buffer, const bytes &iv) const
     {
-        throw std::logic_error("AES-128 Requires a key size of 16 bytes");
+        check_iv(iv);
+        size_t n = buffer.size();
+        buffer.resize(pkcs7_padded_size(n, BLOCK_SIZE));
+        encrypt_cbc_into(iv.data(), buffer.data(), n, buffer.data());
     }
 
-    bytes plaintext_full;
-    unsigned char plaintext[17] = {0};
-    int len;
+    void decrypt_cbc_inplace(bytes &buffer, const bytes &iv) const
+    {
+        check_iv(iv);
+        buffer.resize(decrypt_cbc_into(iv.data(), buffer.data(), buffer.size(), buffer.data()));
+    }
 
-    // Using OpenSSL ECB mode to implement CBC
-    EVP_CIPHER_CTX *ctx;
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+    bytes encrypt_ecb(const bytes &unpadded_plaintext) const
+    {
+        bytes text(pkcs7_padded_size(unpadded_plaintext.size(), BLOCK_SIZE));
+        encrypt_ecb_into(unpadded_plaintext.data(), unpadded_plaintext.size(), text.data());
+        return text;
+    }
 
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, &key[0], NULL))
+    bytes decrypt_ecb(const bytes &ciphertext) const
     {
-        handleErrors();
+        bytes text(ciphertext.size());
+        text.resize(decrypt_ecb_into(ciphertext.data(), ciphertext.size(), text.data()));
+        return text;
     }
 
-    // We are handling padding manually
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    bytes encrypt_cbc(const bytes &unpadded_plaintext, const bytes &iv) const
+    {
+        check_iv(iv);
+        bytes text(pkcs7_padded_size(unpadded_plaintext.size(), BLOCK_SIZE));
+        encrypt_cbc_into(iv.data(), unpadded_plaintext.data(), unpadded_plaintext.size(),
+                         text.data());
+        return text;
+    }
 
-    for (int offset = 0; offset < ciphertext.size(); offset += 16)
+    bytes decrypt_cbc(const bytes &ciphertext, const bytes &iv) const
     {
+        check_iv(iv);
+        bytes text(ciphertext.size());
+        text.resize(
+            decrypt_cbc_into(iv.data(), ciphertext.data(), ciphertext.size(), text.data()));
+        return text;
+    }
 
-        if (1 != EVP_DecryptUpdate(ctx, plaintext, &len, &ciphertext[0] + offset, 16))
+    // Encrypts whole blocks in CBC mode without padding, iv points to 16 bytes. out can be the same
+    // buffer as in
+    void encrypt_cbc_blocks(const byte *iv, const byte *in, size_t n, byte *out) const
+    {
+        detail::check_aes_blocks(n);
+#if CRYPTO_X86_SIMD
+        if (aesni_)
         {
+            detail::aesni_encrypt_cbc(encrypt_keys_, iv, in, n, out);
+            return;
+        }
+#endif
+        ContextLease contexts(*this);
+        EVP_CIPHER_CTX *ctx = contexts.cbc_encrypt();
+        // Keeps the key schedule, only the iv changes
+        if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv))
             handleErrors();
+        detail::cipher_update(ctx, in, n, out, true);
+    }
+
+    // Decrypts whole blocks in CBC mode and leaves the padding, iv points to 16 bytes. out can be
+    // the same buffer as in
+    void decrypt_cbc_blocks(const byte *iv, const byte *in, size_t n, byte *out) const
+    {
+        detail::check_aes_blocks(n);
+#if CRYPTO_X86_SIMD
+        if (aesni_)
+        {
+            detail::aesni_decrypt_cbc(decrypt_keys_, iv, in, n, out);
+            return;
+        }
+#endif
+        // The blocks don't depend on each other, they are all decrypted at once, then XORed with
+        // the previous block of ciphertext in a single pass and the first one with the iv. When
+        // decrypting in place, the ciphertext is saved a slab at a time before it is overwritten
+        ContextLease contexts(*this);
+        EVP_CIPHER_CTX *ctx = contexts.decrypt();
+        byte previous[BLOCK_SIZE];
+        std::copy(iv, iv + BLOCK_SIZE, previous);
+        byte saved[CBC_SLAB_SIZE];
+        size_t slab = in == out ? CBC_SLAB_SIZE : n;
+        for (size_t offset = 0; offset < n; offset += slab)
+        {
+            size_t m = std::min(n - offset, slab);
+            const byte *ciphertext = in + offset;
+            if (in == out)
+                ciphertext = static_cast<const byte *>(memcpy(saved, in + offset, m));
+            detail::cipher_update(ctx, in + offset, m, out + offset, false);
+            detail::xor_bytes(out + offset, previous, BLOCK_SIZE, out + offset);
+            detail::xor_bytes(out + offset + BLOCK_SIZE, ciphertext, m - BLOCK_SIZE,
+                              out + offset + BLOCK_SIZE);
+            std::copy(ciphertext + m - BLOCK_SIZE, ciphertext + m, previous);
         }
+    }
+
+  private:
+    // Bytes of ciphertext saved at a time by decrypt_cbc_blocks when decrypting in place
+    static const size_t CBC_SLAB_SIZE = 4096;
+
+    void copy_key(const Aes128 &other)
+    {
+        std::copy(other.key_, other.key_ + 16, key_);
+        std::copy(other.encrypt_keys_, other.encrypt_keys_ + sizeof(encrypt_keys_), encrypt_keys_);
+        std::copy(other.decrypt_keys_, other.decrypt_keys_ + sizeof(decrypt_keys_), decrypt_keys_);
+        aesni_ = other.aesni_;
+    }
+
+    // The last n < 16 bytes of a plaintext followed by their padding
+    static void pad_last_block(const byte *in, size_t n, byte *block)
+    {
+        std::copy(in, in + n, block);
+        pad_pkcs7_into(block, n, BLOCK_SIZE);
+    }
 
-        plaintext_full.insert(plaintext_full.end(), std::begin(plaintext),
-                              std::begin(plaintext) + len);
-        assert(len == 16);
+    static void check_iv(const bytes &iv)
+    {
+        if (iv.size() != BLOCK_SIZE)
+            throw std::logic_error("AES-128 Requires an iv size of 16 bytes");
+    }
+
+    // https://wiki.openssl.org/index.php/EVP_Symmetric_Encryption_and_Decryption
+    // OpenSSL only ever sees whole blocks, the padding is done here. EVP_*Final is never called, so
+    // a context can be reused for the next message
+    detail::CipherContext new_context(const EVP_CIPHER *cipher, bool encrypt) const
+    {
+        detail::CipherContext ctx(EVP_CIPHER_CTX_new());
+        if (!ctx)
+            handleErrors();
+        if (1 != EVP_CipherInit_ex(ctx.get(), cipher, NULL, key_, NULL, encrypt ? 1 : 0))
+            handleErrors();
+        EVP_CIPHER_CTX_set_padding(ctx.get(), 0);
+        return ctx;
     }
 
-    if (1 != EVP_DecryptFinal_ex(ctx, plaintext, &len))
-        handleErrors();
+    // A set of contexts borrowed from the pool for the duration of one call
+    class ContextLease
+    {
+      public:
+        explicit ContextLease(const Aes128 &aes) : aes_(aes)
+        {
+            std::lock_guard<std::mutex> lock(aes_.mutex_);
+            if (aes_.idle_.empty())
+            {
+                contexts_.reset(new detail::AesContexts());
+            }
+            else
+            {
+                contexts_ = std::move(aes_.idle_.back());
+                aes_.idle_.pop_back();
+            }
+        }
+
+        ~ContextLease()
+        {
+            std::lock_guard<std::mutex> lock(aes_.mutex_);
+            aes_.idle_.push_back(std::move(contexts_));
+        }
+
+        EVP_CIPHER_CTX *encrypt() { return get(contexts_->encrypt, EVP_aes_128_ecb(), true); }
+        EVP_CIPHER_CTX *decrypt() { return get(contexts_->decrypt, EVP_aes_128_ecb(), false); }
+        EVP_CIPHER_CTX *cbc_encrypt()
+        {
+            return get(contexts_->cbc_encrypt, EVP_aes_128_cbc(), true);
+        }
+
+      private:
+        EVP_CIPHER_CTX *get(detail::CipherContext &ctx, const EVP_CIPHER *cipher, bool encrypt)
+        {
+            if (!ctx)
+                ctx = aes_.new_context(cipher, encrypt);
+            return ctx.get();
+        }
+
+        const Aes128 &aes_;
+        std::unique_ptr<detail::AesContexts> contexts_;
+    };
+
+    byte key_[16];
+    // Round keys of the AES-NI backend
+    byte encrypt_keys_[detail::AES_ROUND_KEYS * 16] = {};
+    byte decrypt_keys_[detail::AES_ROUND_KEYS * 16] = {};
+    bool aesni_ = false;
+    // Contexts of the OpenSSL backend that no call is using
+    mutable std::mutex mutex_;
+    mutable std::vector<std::unique_ptr<detail::AesContexts>> idle_;
+};
+
+inline bytes aes128_encrypt_cbc(const bytes &unpadded_plaintext, const bytes &key, const bytes &iv)
+{
+    return Aes128(key).encrypt_cbc(unpadded_plaintext, iv);
+}
+
+inline bytes aes128_encrypt_ecb(const bytes &unpadded_plaintext, const bytes &key)
+{
+    return Aes128(key).encrypt_ecb(unpadded_plaintext);
+}
 
-    plaintext_full.insert(plaintext_full.end(), std::begin(plaintext), std::begin(plaintext) + len);
+inline bytes aes128_decrypt_cbc(const bytes &ciphertext, const bytes &key, const bytes &iv)
+{
+    return Aes128(key).decrypt_cbc(ciphertext, iv);
+}
 
-    EVP_CIPHER_CTX_free(ctx);
-    return unpad_pkcs7(plaintext_full, 16);
-}
\ No newline at end of file
+inline bytes aes128_decrypt_ecb(const bytes &ciphertext, const bytes &key)
+{
+    return Aes128(key).decrypt_ecb(ciphertext);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "crypto.hpp"
+#include "hamming.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// Hamming distances between every pair of many records of the same length, to find which
+// ciphertexts were encrypted with the same key or keystream: XORing two of them cancels the key,
+// and leaves two plaintexts that are much closer to each other than random bytes.
+//
+// The records are packed one after the other in a single arena. The pairs are computed a tile of
+// rows against a tile of columns at a time, the tiles being small enough for both to stay in the
+// L1/L2 cache, and the tiles of the upper triangle are spread over a thread pool. Every distance
+// goes through the vectorized hamming::distance.
+namespace hamming
+{
+struct Pair
+{
+    // a < b
+    size_t a;
+    size_t b;
+    uint64_t distance;
+};
+
+// Bytes of records in a tile, the rows and the columns of a task take twice that
+const size_t MATRIX_TILE_BYTES = 32 << 10;
+
+namespace detail
+{
+// Records in a tile
+inline size_t tile_records(size_t length)
+{
+    return std::max<size_t>(1, MATRIX_TILE_BYTES / std::max<size_t>(length, 1));
+}
+
+// Number of tasks of for_each_pair, one per tile of the upper triangle
+inline size_t pair_tasks(size_t count, size_t length)
+{
+    size_t tiles = (count + tile_records(length) - 1) / tile_records(length);
+    return tiles * (tiles + 1) / 2;
+}
+
+// Calls visit(task, i, j, distance) for every pair i < j of the records, on the workers of the
+// pool. Pairs of the same task are visited by the same worker, one after the other
+template <typename Visit>
+inline void for_each_pair(const byte *records, size_t count, size_t length, ThreadPool &pool,
+                          Visit visit)
+{
+    size_t tile = tile_records(length);
+    size_t tiles = (count + tile - 1) / tile;
+    // The upper triangle of the tiles, the diagonal included
+    std::vector<std::pair<size_t, size_t>> tasks;
+    for (size_t ti = 0; ti < tiles; ti++)
+    {
+        for (size_t tj = ti; tj < tiles; tj++)
+            tasks.emplace_back(ti, tj);
+    }
+    pool.parallel_for(tasks.size(), [&](size_t t) {
+        size_t row_begin = tasks[t].first * tile;
+        size_t row_end = std::min(count, row_begin + tile);
+        size_t column_begin = tasks[t].second * tile;
+        size_t column_end = std::min(count, column_begin + tile);
+        for (size_t i = row_begin; i < row_end; i++)
+        {
+            const byte *a = records + i * length;
+            for (size_t j = std::max(column_begin, i + 1); j < column_end; j++)
+                visit(t, i, j, hamming::distance(a, records + j * length, length));
+        }
+    });
+}
+} // namespace detail
+
+// Packs the first length bytes of every record into an arena for distance_matrix and close_pairs.
+// Throws if a record is shorter than that
+template <typename Records> inline bytes pack_prefixes(const Records &records, size_t length)
+{
+    bytes arena;
+    arena.reserve(records.size() * length);
+    for (const auto &record : records)
+    {
+        if (record.size() < length)
+            throw std::logic_error("Record is shorter than the prefix length");
+        auto begin = std::begin(record);
+        arena.insert(arena.end(), begin, begin + static_cast<std::ptrdiff_t>(length));
+    }
+    return arena;
+}
+
+// The count x count matrix of distances between the records of length bytes in records, row
+// after row. For large counts, only close_pairs is practical
+inline std::vector<uint32_t> distance_matrix(const byte *records, size_t count, size_t length,
+                                             ThreadPool &pool = ThreadPool::shared())
+{
+    if (length > UINT32_MAX / 8)
+        throw std::logic_error("Records are too long for a distance matrix");
+    std::vector<uint32_t> matrix(count * count, 0);
+    detail::for_each_pair(records, count, length, pool,
+                          [&](size_t, size_t i, size_t j, uint64_t distance) {
+                              matrix[i * count + j] = static_cast<uint32_t>(distance);
+                              matrix[j * count + i] = static_cast<uint32_t>(distance);
+                          });
+    return matrix;
+}
+
+// The pairs of records whose distance is at most threshold, ordered by a then b. Only those pairs
+// are kept, so the memory used depends on the number of close pairs, not on count^2
+inline std::vector<Pair> close_pairs(const byte *records, size_t count, size_t length,
+                                     uint64_t threshold, ThreadPool &pool = ThreadPool::shared())
+{
+    std::vector<std::vector<Pair>> found(detail::pair_tasks(count, length));
+    detail::for_each_pair(records, count, length, pool,
+                          [&](size_t task, size_t i, size_t j, uint64_t distance) {
+                              if (distance <= threshold)
+                                  found[task].push_back({i, j, distance});
+                          });
+    std::vector<Pair> pairs;
+    for (const auto &task : found)
+        pairs.insert(pairs.end(), task.begin(), task.end());
+    std::sort(pairs.begin(), pairs.end(),
+              [](const Pair &x, const Pair &y) { return x.a != y.a ? x.a < y.a : x.b < y.b; });
+    return pairs;
+}
+} // namespace hamming
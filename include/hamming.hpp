@@ -0,0 +1,170 @@
+#pragma once
+#include "crypto.hpp"
+#include <iterator>
+#include <stdexcept>
+
+// Hamming distance, the number of differing bits, between two byte sequences of equal length.
+//
+// Contiguous buffers are XORed a word or a vector register at a time and the set bits are counted
+// with the widest instruction the CPU has: VPOPCNTDQ on AVX-512, a nibble lookup with VPSHUFB on
+// AVX2, and POPCNT on 64 bit words otherwise. Other iterators are compared byte by byte.
+namespace hamming
+{
+namespace detail
+{
+// Adds the distance of the first bytes of a and b to bits and returns how many bytes it covered
+using distance_kernel = size_t (*)(const byte *a, const byte *b, size_t n, uint64_t &bits);
+
+inline size_t distance_scalar(const byte *a, const byte *b, size_t n, uint64_t &bits)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        bits += static_cast<uint64_t>(__builtin_popcountll(x ^ y));
+    }
+    for (; i < n; i++)
+        bits += static_cast<uint64_t>(__builtin_popcount(a[i] ^ b[i]));
+    return n;
+}
+
+#if CRYPTO_X86_SIMD
+// Same as distance_scalar, but __builtin_popcountll becomes a single instruction
+__attribute__((target("popcnt"))) inline size_t distance_popcnt(const byte *a, const byte *b,
+                                                                size_t n, uint64_t &bits)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        bits += static_cast<uint64_t>(__builtin_popcountll(x ^ y));
+    }
+    for (; i < n; i++)
+        bits += static_cast<uint64_t>(__builtin_popcount(a[i] ^ b[i]));
+    return n;
+}
+
+// Counts the bits of both nibbles of every byte with a 16 entry table, then sums the byte counts
+// into 64 bit lanes with VPSADBW
+__attribute__((target("avx2"))) inline size_t distance_avx2(const byte *a, const byte *b, size_t n,
+                                                            uint64_t &bits)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                                           2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+        __m256i lo = _mm256_and_si256(x, low_nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_nibble);
+        __m256i count =
+            _mm256_add_epi8(_mm256_shuffle_epi8(table, lo), _mm256_shuffle_epi8(table, hi));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(count, _mm256_setzero_si256()));
+    }
+    bits += static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) +
+            static_cast<uint64_t>(_mm256_extract_epi64(total, 1)) +
+            static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) +
+            static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+    return i;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) inline size_t
+distance_avx512(const byte *a, const byte *b, size_t n, uint64_t &bits)
+{
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __m512i x = _mm512_xor_si512(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(x));
+    }
+    bits += static_cast<uint64_t>(_mm512_reduce_add_epi64(total));
+    return i;
+}
+#endif
+
+inline distance_kernel select_distance_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx512vpopcntdq)
+        return distance_avx512;
+    if (cpu::features().avx2)
+        return distance_avx2;
+    if (cpu::features().popcnt)
+        return distance_popcnt;
+#endif
+    return distance_scalar;
+}
+
+// Finishes what the vector kernels leave, less than one register
+inline distance_kernel select_tail_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().popcnt)
+        return distance_popcnt;
+#endif
+    return distance_scalar;
+}
+
+template <typename Iter1, typename Iter2>
+inline uint64_t distance(Iter1 b1_beg, Iter1 b1_end, Iter2 b2_beg, Iter2 b2_end, std::true_type);
+
+template <typename Iter1, typename Iter2>
+inline uint64_t distance(Iter1 b1_beg, Iter1 b1_end, Iter2 b2_beg, Iter2 b2_end, std::false_type)
+{
+    uint64_t bits = 0;
+    while (b1_beg != b1_end && b2_beg != b2_end)
+        bits += static_cast<uint64_t>(__builtin_popcount(static_cast<byte>(*b1_beg++ ^ *b2_beg++)));
+    if (b1_beg != b1_end || b2_beg != b2_end)
+        throw std::logic_error("Cannot calculate hamming distance for sequences of uneven length");
+    return bits;
+}
+} // namespace detail
+
+inline uint64_t distance(const byte *a, const byte *b, size_t n)
+{
+    static const detail::distance_kernel fast = detail::select_distance_kernel();
+    static const detail::distance_kernel tail = detail::select_tail_kernel();
+    uint64_t bits = 0;
+    size_t done = fast(a, b, n, bits);
+    tail(a + done, b + done, n - done, bits);
+    return bits;
+}
+
+// Contiguous ranges take the vectorized path, any other iterators the byte by byte loop
+template <typename Iter1, typename Iter2>
+inline uint64_t distance(Iter1 b1_beg, Iter1 b1_end, Iter2 b2_beg, Iter2 b2_end)
+{
+    using contiguous =
+        std::integral_constant<bool, ::detail::is_contiguous_bytes<Iter1>::value &&
+                                         ::detail::is_contiguous_bytes<Iter2>::value>;
+    return detail::distance(b1_beg, b1_end, b2_beg, b2_end, contiguous());
+}
+
+template <typename A, typename B> inline uint64_t distance(const A &a, const B &b)
+{
+    return distance(std::begin(a), std::end(a), std::begin(b), std::end(b));
+}
+
+namespace detail
+{
+template <typename Iter1, typename Iter2>
+inline uint64_t distance(Iter1 b1_beg, Iter1 b1_end, Iter2 b2_beg, Iter2 b2_end, std::true_type)
+{
+    auto n = std::distance(b1_beg, b1_end);
+    if (n != std::distance(b2_beg, b2_end))
+        throw std::logic_error("Cannot calculate hamming distance for sequences of uneven length");
+    if (n == 0)
+        return 0;
+    return hamming::distance(::detail::byte_pointer(b1_beg), ::detail::byte_pointer(b2_beg),
+                             static_cast<size_t>(n));
+}
+} // namespace detail
+} // namespace hamming
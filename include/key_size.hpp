@@ -0,0 +1,119 @@
+#pragma once
+#include "crypto.hpp"
+#include "hamming.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Estimates the length of the key of a repeating key XOR ciphertext.
+//
+// Cut the ciphertext into blocks of the key size. When the key size is right, two blocks are XORed
+// with the same key, so their Hamming distance is the distance of two plaintexts, which is small
+// for text. Averaging over all the pairs of adjacent blocks instead of the first few makes the
+// ranking much sharper. Since adjacent pairs overlap, the distance of all of them is the distance
+// between the ciphertext and itself shifted by one block, a single call to the vectorized kernel.
+//
+// Multiples of the key size line blocks up on the key as well and score about the same, so a key
+// size is ranked after its divisors when one of them is about as close.
+namespace key_size
+{
+struct Estimate
+{
+    size_t key_size;
+    // Average number of differing bits per byte, over the pairs of blocks that were compared
+    double distance;
+    size_t pairs;
+};
+
+// Average distance of the adjacent blocks of key_size bytes. With max_pairs > 0, at most that many
+// pairs spread evenly over the ciphertext are compared. Key sizes with fewer than two blocks get
+// an infinite distance
+inline Estimate normalized_distance(const byte *data, size_t n, size_t key_size,
+                                    size_t max_pairs = 0)
+{
+    size_t blocks = key_size > 0 ? n / key_size : 0;
+    if (blocks < 2)
+        return {key_size, std::numeric_limits<double>::infinity(), 0};
+    size_t pairs = blocks - 1;
+    uint64_t bits = 0;
+    if (max_pairs == 0 || pairs <= max_pairs)
+    {
+        bits = hamming::distance(data, data + key_size, pairs * key_size);
+    }
+    else
+    {
+        for (size_t i = 0; i < max_pairs; i++)
+        {
+            const byte *block = data + (i * pairs / max_pairs) * key_size;
+            bits += hamming::distance(block, block + key_size, key_size);
+        }
+        pairs = max_pairs;
+    }
+    return {key_size, static_cast<double>(bits) / static_cast<double>(pairs * key_size), pairs};
+}
+
+// A multiple of a key size whose distance is at most this much larger than the distance of the
+// multiple is taken as a repetition of the smaller key
+const double MULTIPLE_TOLERANCE = 0.05;
+
+// The count most likely key sizes, smallest distance first, except that multiples of a key size
+// that explains them come after all the other key sizes. estimates[i] is the estimate of key size
+// estimates[0].key_size + i
+inline std::vector<Estimate> rank(std::vector<Estimate> estimates, size_t count)
+{
+    if (estimates.empty())
+        return estimates;
+    size_t min_size = estimates[0].key_size;
+    std::vector<char> multiple(estimates.size(), 0);
+    for (size_t i = 0; i < estimates.size(); i++)
+    {
+        size_t size = estimates[i].key_size;
+        for (size_t divisor = min_size; divisor < size; divisor++)
+        {
+            if (size % divisor == 0 &&
+                estimates[divisor - min_size].distance <=
+                    estimates[i].distance * (1 + MULTIPLE_TOLERANCE))
+                multiple[i] = 1;
+        }
+    }
+    auto order = [&](const Estimate &a, const Estimate &b) {
+        char a_multiple = multiple[a.key_size - min_size];
+        char b_multiple = multiple[b.key_size - min_size];
+        if (a_multiple != b_multiple)
+            return a_multiple < b_multiple;
+        if (a.distance < b.distance || b.distance < a.distance)
+            return a.distance < b.distance;
+        return a.key_size < b.key_size;
+    };
+    count = std::min(count, estimates.size());
+    std::partial_sort(estimates.begin(), estimates.begin() + static_cast<std::ptrdiff_t>(count),
+                      estimates.end(), order);
+    estimates.resize(count);
+    return estimates;
+}
+
+// The count most likely key sizes in [min_size, max_size], ranked by rank
+inline std::vector<Estimate> estimate(const byte *data, size_t n, size_t min_size, size_t max_size,
+                                      size_t count, size_t max_pairs = 0,
+                                      ThreadPool &pool = ThreadPool::shared())
+{
+    min_size = std::max<size_t>(min_size, 1);
+    if (max_size < min_size)
+        return {};
+    std::vector<Estimate> estimates(max_size - min_size + 1);
+    pool.parallel_for(estimates.size(), [&](size_t i) {
+        estimates[i] = normalized_distance(data, n, min_size + i, max_pairs);
+    });
+    return rank(std::move(estimates), count);
+}
+
+template <typename T>
+inline std::vector<Estimate> estimate(const T &ciphertext, size_t min_size, size_t max_size,
+                                      size_t count, size_t max_pairs = 0,
+                                      ThreadPool &pool = ThreadPool::shared())
+{
+    return estimate(::detail::container_data(ciphertext), ciphertext.size(), min_size, max_size,
+                    count, max_pairs, pool);
+}
+} // namespace key_size
@@ -0,0 +1,228 @@
+#pragma once
+#include "batch_scorer.hpp"
+#include "crypto.hpp"
+#include "mapped_file.hpp"
+#include "single_byte_xor.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Finds the lines of a file of hex strings that are most likely single byte XOR encrypted text.
+// The file is memory mapped and cut into chunks at line boundaries, and the workers of a thread
+// pool take chunks one after the other. Every worker keeps only its best lines, so the memory used
+// depends on the number of workers and results, not on the size of the file.
+namespace single_byte_xor
+{
+struct LineMatch
+{
+    // Zero based line number
+    uint64_t line;
+    // Position and length of the line in the file, without the line ending
+    size_t offset;
+    size_t length;
+    byte key;
+    int64_t score;
+    bytes plaintext;
+};
+
+struct ScanStats
+{
+    uint64_t lines = 0;
+    // Lines skipped because they are not valid hex
+    uint64_t invalid_lines = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+
+    double bytes_per_second() const
+    {
+        return seconds > 0 ? static_cast<double>(bytes) / seconds : 0;
+    }
+};
+
+struct ScanResult
+{
+    // Highest score first, earlier lines first when the scores are equal
+    std::vector<LineMatch> best;
+    ScanStats stats;
+};
+
+namespace detail
+{
+struct Match
+{
+    size_t chunk;
+    // Line number within the chunk
+    uint64_t line;
+    size_t offset;
+    size_t length;
+    byte key;
+    int64_t score;
+};
+
+inline bool better(const Match &a, const Match &b)
+{
+    if (a.score != b.score)
+        return a.score > b.score;
+    return a.chunk != b.chunk ? a.chunk < b.chunk : a.line < b.line;
+}
+
+// Keeps the count best matches pushed into it. The heap has the worst of them at the front
+class TopK
+{
+  public:
+    explicit TopK(size_t count) : count_(count) {}
+
+    void push(const Match &m)
+    {
+        if (heap_.size() < count_)
+        {
+            heap_.push_back(m);
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        }
+        else if (count_ > 0 && better(m, heap_.front()))
+        {
+            std::pop_heap(heap_.begin(), heap_.end(), better);
+            heap_.back() = m;
+            std::push_heap(heap_.begin(), heap_.end(), better);
+        }
+    }
+
+    const std::vector<Match> &matches() const { return heap_; }
+
+  private:
+    size_t count_;
+    std::vector<Match> heap_;
+};
+
+// Starts of the chunks, each chunk except the last one ends with a newline
+inline std::vector<size_t> split_at_lines(const byte *data, size_t n, size_t chunk_size)
+{
+    std::vector<size_t> starts;
+    size_t begin = 0;
+    while (begin < n)
+    {
+        starts.push_back(begin);
+        size_t end = std::min(n, begin + chunk_size);
+        if (end < n)
+        {
+            auto newline = static_cast<const byte *>(memchr(data + end, '\n', n - end));
+            end = newline != nullptr ? static_cast<size_t>(newline - data) + 1 : n;
+        }
+        begin = end;
+    }
+    starts.push_back(n);
+    return starts;
+}
+} // namespace detail
+
+// Scores every line of [data, data + n) with the best single byte key and returns the count best
+// lines. Lines may end with "\n" or "\r\n", lines that are not valid hex are counted and skipped
+inline ScanResult scan_hex_lines(const byte *data, size_t n, const int (&weights)[256],
+                                 size_t count, ThreadPool &pool = ThreadPool::shared(),
+                                 size_t chunk_size = 1 << 20)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> starts = detail::split_at_lines(data, n, std::max<size_t>(chunk_size, 1));
+    size_t chunks = starts.size() - 1;
+    std::vector<uint64_t> chunk_lines(chunks);
+    std::vector<detail::TopK> heaps(pool.size(), detail::TopK(count));
+    std::atomic<uint64_t> invalid_lines(0);
+    std::atomic<size_t> next_chunk(0);
+    const KeyScorer scorer(weights);
+
+    pool.parallel_for(pool.size(), [&](size_t worker) {
+        detail::TopK &heap = heaps[worker];
+        // The valid lines of a chunk are decoded into one batch and scored together
+        Batch batch;
+        std::vector<detail::Match> lines;
+        std::vector<byte> keys;
+        std::vector<int64_t> scores;
+        uint64_t invalid = 0;
+        size_t chunk;
+        while ((chunk = next_chunk++) < chunks)
+        {
+            const byte *p = data + starts[chunk];
+            const byte *end = data + starts[chunk + 1];
+            batch.clear();
+            lines.clear();
+            uint64_t line = 0;
+            for (; p < end; line++)
+            {
+                size_t remaining = static_cast<size_t>(end - p);
+                auto newline = static_cast<const byte *>(memchr(p, '\n', remaining));
+                const byte *line_end = newline != nullptr ? newline : end;
+                const byte *next = newline != nullptr ? newline + 1 : end;
+                if (line_end > p && line_end[-1] == '\r')
+                    line_end--;
+                size_t length = static_cast<size_t>(line_end - p);
+                const byte *begin = p;
+                p = next;
+                if (length == 0)
+                    continue;
+                try
+                {
+                    hex::detail::decode(begin, length, batch.append(length / 2));
+                }
+                catch (const std::runtime_error &)
+                {
+                    batch.pop_back();
+                    invalid++;
+                    continue;
+                }
+                size_t offset = static_cast<size_t>(begin - data);
+                lines.push_back({chunk, line, offset, length, 0, 0});
+            }
+            chunk_lines[chunk] = line;
+
+            keys.resize(batch.size());
+            scores.resize(batch.size());
+            detail::score_records(batch, 0, batch.size(), scorer, keys.data(), scores.data());
+            for (size_t r = 0; r < lines.size(); r++)
+            {
+                lines[r].key = keys[r];
+                lines[r].score = scores[r];
+                heap.push(lines[r]);
+            }
+        }
+        invalid_lines += invalid;
+    });
+
+    std::vector<detail::Match> matches;
+    for (const auto &heap : heaps)
+        matches.insert(matches.end(), heap.matches().begin(), heap.matches().end());
+    std::sort(matches.begin(), matches.end(), detail::better);
+    if (matches.size() > count)
+        matches.resize(count);
+
+    // Line numbers within a chunk become line numbers within the file
+    std::vector<uint64_t> first_line(chunks + 1, 0);
+    for (size_t c = 0; c < chunks; c++)
+        first_line[c + 1] = first_line[c] + chunk_lines[c];
+
+    ScanResult result;
+    for (const auto &m : matches)
+    {
+        bytes plaintext = hex::to_bytes(data + m.offset, data + m.offset + m.length);
+        for (auto &b : plaintext)
+            b ^= m.key;
+        uint64_t line = first_line[m.chunk] + m.line;
+        result.best.push_back({line, m.offset, m.length, m.key, m.score, std::move(plaintext)});
+    }
+    result.stats.lines = first_line[chunks];
+    result.stats.invalid_lines = invalid_lines;
+    result.stats.bytes = n;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.stats.seconds = elapsed.count();
+    return result;
+}
+
+inline ScanResult scan_hex_file(const std::string &path, const int (&weights)[256], size_t count,
+                                ThreadPool &pool = ThreadPool::shared())
+{
+    MappedFile file(path);
+    return scan_hex_lines(file.data(), file.size(), weights, count, pool);
+}
+} // namespace single_byte_xor
@@ -0,0 +1,86 @@
+#pragma once
+#include "crypto.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+
+// A whole file mapped into memory. Empty files are not mapped, data() is then null.
+class MappedFile
+{
+  public:
+    // Maps an existing file read only
+    explicit MappedFile(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            fail(fd, path);
+        size_ = static_cast<size_t>(st.st_size);
+        map(fd, PROT_READ, path);
+        ::close(fd);
+        if (data_ != nullptr)
+            ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+
+    // Creates (or truncates) a file of the given size and maps it for writing
+    MappedFile(const std::string &path, size_t size) : size_(size)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+            fail(fd, path);
+        map(fd, PROT_READ | PROT_WRITE, path);
+        ::close(fd);
+    }
+
+    MappedFile(MappedFile &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+    {
+    }
+
+    MappedFile &operator=(MappedFile &&other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~MappedFile()
+    {
+        if (data_ != nullptr)
+            ::munmap(data_, size_);
+    }
+
+    byte *data() { return static_cast<byte *>(data_); }
+    const byte *data() const { return static_cast<const byte *>(data_); }
+    size_t size() const { return size_; }
+
+  private:
+    void map(int fd, int protection, const std::string &path)
+    {
+        if (size_ == 0)
+            return;
+        void *p = ::mmap(nullptr, size_, protection, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            fail(fd, path);
+        data_ = p;
+    }
+
+    [[noreturn]] static void fail(int fd, const std::string &path)
+    {
+        int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+
+    void *data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include "crypto.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <vector>
+
+// AES-128 in ECB mode and CBC decryption of large buffers on a thread pool.
+//
+// The blocks of ECB don't depend on each other, and neither do those of CBC decryption: a block of
+// plaintext only needs its own ciphertext block and the previous one. The buffer is split into
+// segments of whole blocks that are processed at the same time, every CBC segment using the last
+// ciphertext block of the segment before it as its iv. Each segment is written straight into its
+// part of the output, and the result is the same as the one of the serial Aes128 functions. CBC
+// encryption is serial by nature and is not here.
+namespace parallel_aes
+{
+// Bytes of input handled by one task, a multiple of the block size. Smaller buffers are processed
+// by the calling thread
+const size_t SEGMENT_SIZE = 1 << 20;
+
+namespace detail
+{
+// Rounds the segment size down to whole blocks, at least one
+inline size_t whole_blocks(size_t segment_size)
+{
+    return std::max<size_t>(segment_size / Aes128::BLOCK_SIZE, 1) * Aes128::BLOCK_SIZE;
+}
+
+// Calls process(begin, end) for every segment of [0, n), on the workers of the pool
+template <typename Process>
+inline void for_each_segment(size_t n, size_t segment_size, ThreadPool &pool, Process process)
+{
+    segment_size = whole_blocks(segment_size);
+    size_t segments = (n + segment_size - 1) / segment_size;
+    if (segments <= 1 || pool.size() <= 1)
+    {
+        process(0, n);
+        return;
+    }
+    pool.parallel_for(segments, [&](size_t s) {
+        size_t begin = s * segment_size;
+        process(begin, std::min(n, begin + segment_size));
+    });
+}
+} // namespace detail
+
+// Encrypts / decrypts n bytes of whole blocks in ECB mode, out can be the same buffer as in
+inline void encrypt_blocks(const Aes128 &aes, const byte *in, size_t n, byte *out,
+                           ThreadPool &pool = ThreadPool::shared(),
+                           size_t segment_size = SEGMENT_SIZE)
+{
+    ::detail::check_aes_blocks(n);
+    detail::for_each_segment(n, segment_size, pool, [&](size_t begin, size_t end) {
+        aes.encrypt_blocks(in + begin, end - begin, out + begin);
+    });
+}
+
+inline void decrypt_blocks(const Aes128 &aes, const byte *in, size_t n, byte *out,
+                           ThreadPool &pool = ThreadPool::shared(),
+                           size_t segment_size = SEGMENT_SIZE)
+{
+    ::detail::check_aes_blocks(n);
+    detail::for_each_segment(n, segment_size, pool, [&](size_t begin, size_t end) {
+        aes.decrypt_blocks(in + begin, end - begin, out + begin);
+    });
+}
+
+// Decrypts n bytes of whole blocks in CBC mode and leaves the padding, iv points to 16 bytes. out
+// can be the same buffer as in
+inline void decrypt_cbc_blocks(const Aes128 &aes, const byte *iv, const byte *in, size_t n,
+                               byte *out, ThreadPool &pool = ThreadPool::shared(),
+                               size_t segment_size = SEGMENT_SIZE)
+{
+    ::detail::check_aes_blocks(n);
+    if (n == 0)
+        return;
+    if (in != out)
+    {
+        detail::for_each_segment(n, segment_size, pool, [&](size_t begin, size_t end) {
+            aes.decrypt_cbc_blocks(begin == 0 ? iv : in + begin - Aes128::BLOCK_SIZE, in + begin,
+                                   end - begin, out + begin);
+        });
+        return;
+    }
+    // In place, the last ciphertext block of a segment can be overwritten before the next
+    // segment reads it, so the ivs of all the segments are saved first
+    size_t segment = detail::whole_blocks(segment_size);
+    bytes ivs;
+    for (size_t begin = 0; begin < n; begin += segment)
+    {
+        const byte *previous = begin == 0 ? iv : in + begin - Aes128::BLOCK_SIZE;
+        ivs.insert(ivs.end(), previous, previous + Aes128::BLOCK_SIZE);
+    }
+    detail::for_each_segment(n, segment_size, pool, [&](size_t begin, size_t end) {
+        aes.decrypt_cbc_blocks(&ivs[begin / segment * Aes128::BLOCK_SIZE], in + begin,
+                               end - begin, out + begin);
+    });
+}
+
+inline bytes encrypt_ecb(const Aes128 &aes, const bytes &unpadded_plaintext,
+                         ThreadPool &pool = ThreadPool::shared())
+{
+    bytes text(pkcs7_padded_size(unpadded_plaintext.size(), Aes128::BLOCK_SIZE));
+    std::copy(unpadded_plaintext.begin(), unpadded_plaintext.end(), text.begin());
+    pad_pkcs7_into(text.data(), unpadded_plaintext.size(), Aes128::BLOCK_SIZE);
+    encrypt_blocks(aes, text.data(), text.size(), text.data(), pool);
+    return text;
+}
+
+inline bytes decrypt_ecb(const Aes128 &aes, const bytes &ciphertext,
+                         ThreadPool &pool = ThreadPool::shared())
+{
+    bytes text(ciphertext.size());
+    decrypt_blocks(aes, ciphertext.data(), ciphertext.size(), text.data(), pool);
+    text.resize(pkcs7_unpadded_size(text.data(), text.size(), Aes128::BLOCK_SIZE));
+    return text;
+}
+
+inline bytes decrypt_cbc(const Aes128 &aes, const bytes &ciphertext, const bytes &iv,
+                         ThreadPool &pool = ThreadPool::shared())
+{
+    if (iv.size() != Aes128::BLOCK_SIZE)
+        throw std::logic_error("AES-128 Requires an iv size of 16 bytes");
+    bytes text(ciphertext.size());
+    decrypt_cbc_blocks(aes, iv.data(), ciphertext.data(), ciphertext.size(), text.data(), pool);
+    text.resize(pkcs7_unpadded_size(text.data(), text.size(), Aes128::BLOCK_SIZE));
+    return text;
+}
+} // namespace parallel_aes
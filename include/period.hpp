@@ -0,0 +1,186 @@
+#pragma once
+#include "crypto.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// Finds the period of a repeating key XOR ciphertext from its autocorrelation.
+//
+// Two ciphertext bytes that are a multiple of the key length apart are XORed with the same key
+// byte, so they are equal exactly when their plaintexts are: about 6% of the time for english,
+// against 1/256 for bytes XORed with different key bytes. The spectrum is the rate of equal bytes
+// at every shift, and the key length is the first shift where it stands out.
+//
+// Every shift up to the bound is counted, a 16 KB tile of the ciphertext at a time so that the tile
+// and the bytes it is compared to stay in the cache while the shifts go by. Tiles are counted in
+// parallel, and equal bytes are counted a vector register at a time.
+namespace period
+{
+namespace detail
+{
+// Adds the number of i with a[i] == b[i] among the first bytes to matches and returns how many
+// bytes it covered
+using match_kernel = size_t (*)(const byte *a, const byte *b, size_t n, uint64_t &matches);
+
+inline size_t matches_scalar(const byte *a, const byte *b, size_t n, uint64_t &matches)
+{
+    const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        x ^= y;
+        // The high bit of every byte of x is set if the byte is not zero, exactly
+        uint64_t nonzero = ((x & low7) + low7) | x;
+        matches += static_cast<uint64_t>(__builtin_popcountll(~(nonzero | low7)));
+    }
+    for (; i < n; i++)
+        matches += a[i] == b[i];
+    return n;
+}
+
+#if CRYPTO_X86_SIMD
+// Equal bytes give -1, which is subtracted from byte counters. The counters are summed with
+// VPSADBW before they can overflow
+__attribute__((target("avx2"))) inline size_t matches_avx2(const byte *a, const byte *b, size_t n,
+                                                           uint64_t &matches)
+{
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i + 32 <= n)
+    {
+        __m256i counters = _mm256_setzero_si256();
+        size_t end = std::min(n - (n - i) % 32, i + 255 * 32);
+        for (; i < end; i += 32)
+        {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(x, y));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counters, _mm256_setzero_si256()));
+    }
+    matches += static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) +
+               static_cast<uint64_t>(_mm256_extract_epi64(total, 1)) +
+               static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) +
+               static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt"))) inline size_t
+matches_avx512(const byte *a, const byte *b, size_t n, uint64_t &matches)
+{
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+    {
+        __mmask64 equal =
+            _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        matches += static_cast<uint64_t>(__builtin_popcountll(equal));
+    }
+    return i;
+}
+#endif
+
+inline match_kernel select_match_kernel()
+{
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx512bw && cpu::features().popcnt)
+        return matches_avx512;
+    if (cpu::features().avx2)
+        return matches_avx2;
+#endif
+    return matches_scalar;
+}
+} // namespace detail
+
+// Number of i in [0, n) with a[i] == b[i]
+inline uint64_t count_matches(const byte *a, const byte *b, size_t n)
+{
+    static const detail::match_kernel fast = detail::select_match_kernel();
+    uint64_t matches = 0;
+    size_t done = fast(a, b, n, matches);
+    detail::matches_scalar(a + done, b + done, n - done, matches);
+    return matches;
+}
+
+// Bytes of the ciphertext compared with every shift at a time
+const size_t TILE_SIZE = 16 << 10;
+
+// Rate of equal bytes at every shift in [0, max_shift], spectrum[s] is the fraction of the pairs
+// of bytes s apart that are equal, and spectrum[0] is 1. Only the first max_bytes of the ciphertext
+// are used when max_bytes > 0, which is plenty to find periods much shorter than that
+inline std::vector<double> spectrum(const byte *data, size_t n, size_t max_shift,
+                                    size_t max_bytes = 0,
+                                    ThreadPool &pool = ThreadPool::shared())
+{
+    if (max_bytes > 0)
+        n = std::min(n, max_bytes);
+    std::vector<double> rates(max_shift + 1, 0);
+    rates[0] = 1;
+    if (n < 2 || max_shift == 0)
+        return rates;
+
+    size_t shifts = std::min(max_shift, n - 1);
+    // Pairs (i, i + s) are counted by the tile that holds i
+    size_t tiles = (n - 1 + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<std::vector<uint64_t>> counts(pool.size());
+    std::atomic<size_t> next_tile(0);
+    pool.parallel_for(pool.size(), [&](size_t worker) {
+        std::vector<uint64_t> &matches = counts[worker];
+        matches.assign(shifts + 1, 0);
+        size_t tile;
+        while ((tile = next_tile++) < tiles)
+        {
+            size_t begin = tile * TILE_SIZE;
+            size_t end = std::min(n, begin + TILE_SIZE);
+            for (size_t s = 1; s <= shifts && begin + s < n; s++)
+            {
+                size_t length = std::min(end, n - s) - begin;
+                matches[s] += count_matches(data + begin, data + begin + s, length);
+            }
+        }
+    });
+
+    for (size_t s = 1; s <= shifts; s++)
+    {
+        uint64_t matches = 0;
+        for (const auto &worker : counts)
+            matches += worker.empty() ? 0 : worker[s];
+        rates[s] = static_cast<double>(matches) / static_cast<double>(n - s);
+    }
+    return rates;
+}
+
+template <typename T>
+inline std::vector<double> spectrum(const T &ciphertext, size_t max_shift, size_t max_bytes = 0,
+                                    ThreadPool &pool = ThreadPool::shared())
+{
+    return spectrum(::detail::container_data(ciphertext), ciphertext.size(), max_shift, max_bytes,
+                    pool);
+}
+
+// The key length, the first shift whose rate is above the midpoint between the median rate and the
+// highest one. The multiples of the key length are just as high, the shifts in between are not.
+// Returns 0 if no shift stands out
+inline size_t detect_period(const std::vector<double> &rates)
+{
+    if (rates.size() < 2)
+        return 0;
+    std::vector<double> sorted(rates.begin() + 1, rates.end());
+    auto middle = sorted.begin() + static_cast<std::ptrdiff_t>(sorted.size() / 2);
+    std::nth_element(sorted.begin(), middle, sorted.end());
+    double median = *middle;
+    double highest = *std::max_element(rates.begin() + 1, rates.end());
+    if (highest <= median)
+        return 0;
+    double threshold = (median + highest) / 2;
+    for (size_t s = 1; s < rates.size(); s++)
+    {
+        if (rates[s] >= threshold)
+            return s;
+    }
+    return 0;
+}
+} // namespace period
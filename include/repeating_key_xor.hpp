@@ -0,0 +1,327 @@
+#pragma once
+#include "columns.hpp"
+#include "crypto.hpp"
+#include "key_size.hpp"
+#include "single_byte_xor.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+// Recovers the key of a text XORed with a repeating key.
+//
+// The most likely key sizes are estimated from the Hamming distance between blocks, then every
+// column of every one of those key sizes is solved as a single byte XOR. The columns are
+// independent, so they are all solved in parallel on a thread pool. The score of a candidate is the
+// sum of the scores of its columns, which is the score of its plaintext.
+namespace repeating_key_xor
+{
+struct Candidate
+{
+    bytes key;
+    size_t key_size;
+    int64_t score;
+    bytes plaintext;
+};
+
+struct Options
+{
+    size_t min_key_size = 2;
+    size_t max_key_size = 40;
+    // Number of the most likely key sizes that are solved
+    size_t key_sizes = 2;
+    // Pairs of blocks compared to estimate a key size, 0 for all of them
+    size_t max_pairs = 0;
+    // The search stops once this much time has passed, zero for no limit
+    std::chrono::steady_clock::duration time_budget = std::chrono::steady_clock::duration::zero();
+    // The search stops once this becomes true
+    const std::atomic<bool> *cancel = nullptr;
+};
+
+struct CrackResult
+{
+    // Highest score first, shorter keys first when the scores are equal
+    std::vector<Candidate> candidates;
+    // False if the search was stopped before every key size was solved. The candidates are then
+    // the key sizes that were solved completely
+    bool complete = true;
+};
+
+namespace detail
+{
+inline void rank_candidates(std::vector<Candidate> &candidates)
+{
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.score != b.score ? a.score > b.score : a.key_size < b.key_size;
+    });
+}
+} // namespace detail
+
+inline CrackResult crack(const byte *data, size_t n, const int (&weights)[256],
+                         const Options &options = Options(),
+                         ThreadPool &pool = ThreadPool::shared())
+{
+    auto deadline = std::chrono::steady_clock::now() + options.time_budget;
+    auto stopped = [&] {
+        if (options.cancel != nullptr && options.cancel->load())
+            return true;
+        return options.time_budget != std::chrono::steady_clock::duration::zero() &&
+               std::chrono::steady_clock::now() >= deadline;
+    };
+
+    CrackResult result;
+    auto estimates = key_size::estimate(data, n, options.min_key_size, options.max_key_size,
+                                        options.key_sizes, options.max_pairs, pool);
+    // Columns without any byte cannot be solved
+    estimates.erase(std::remove_if(estimates.begin(), estimates.end(),
+                                   [n](const key_size::Estimate &e) { return e.key_size > n; }),
+                    estimates.end());
+
+    // The histograms of the columns of every key size, then one task per column
+    std::vector<std::vector<single_byte_xor::Histogram>> histograms(estimates.size());
+    pool.parallel_for(estimates.size(), [&](size_t i) {
+        if (!stopped())
+            histograms[i] = columns::histograms(data, n, estimates[i].key_size);
+    });
+    std::vector<Candidate> candidates(estimates.size());
+    std::vector<std::pair<size_t, size_t>> tasks;
+    for (size_t i = 0; i < estimates.size(); i++)
+    {
+        candidates[i].key_size = estimates[i].key_size;
+        candidates[i].key.resize(estimates[i].key_size);
+        candidates[i].score = 0;
+        for (size_t c = 0; c < histograms[i].size(); c++)
+            tasks.emplace_back(i, c);
+    }
+
+    const single_byte_xor::KeyScorer scorer(weights);
+    std::vector<single_byte_xor::Candidate> best(tasks.size());
+    std::vector<char> solved(tasks.size(), 0);
+    pool.parallel_for(tasks.size(), [&](size_t t) {
+        if (stopped())
+            return;
+        const auto &h = histograms[tasks[t].first][tasks[t].second];
+        best[t] = single_byte_xor::best_key(scorer.score_keys(h));
+        solved[t] = 1;
+    });
+
+    std::vector<size_t> solved_columns(candidates.size(), 0);
+    for (size_t t = 0; t < tasks.size(); t++)
+    {
+        if (!solved[t])
+            continue;
+        Candidate &candidate = candidates[tasks[t].first];
+        candidate.key[tasks[t].second] = best[t].key;
+        candidate.score += best[t].score;
+        solved_columns[tasks[t].first]++;
+    }
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (solved_columns[i] == candidates[i].key_size)
+            result.candidates.push_back(std::move(candidates[i]));
+        else
+            result.complete = false;
+    }
+    detail::rank_candidates(result.candidates);
+
+    pool.parallel_for(result.candidates.size(), [&](size_t i) {
+        Candidate &candidate = result.candidates[i];
+        candidate.plaintext = repeating_key_XOR(data, data + n, candidate.key.begin(),
+                                                candidate.key.end());
+    });
+    return result;
+}
+
+template <typename T>
+inline CrackResult crack(const T &ciphertext, const int (&weights)[256],
+                         const Options &options = Options(),
+                         ThreadPool &pool = ThreadPool::shared())
+{
+    return crack(::detail::container_data(ciphertext), ciphertext.size(), weights, options, pool);
+}
+
+// Cracks a ciphertext that is fed in chunks, in a single pass and without keeping it in memory.
+//
+// The Hamming distance between the bytes key size apart is measured over the whole input, for
+// every key size, which is all that the key size estimate needs. The key sizes whose columns are
+// solved are picked from the first SAMPLE_BLOCK bytes, which are held until then: the
+// solved_key_sizes most likely ones get a histogram for each of their columns, counted from the
+// start of the input. The memory used is O(solved_key_sizes * max_key_size * 256) plus one block,
+// whatever the size of the input, so the input can be a pipe. With sample_every > 1, only one
+// block of SAMPLE_BLOCK bytes in every sample_every is analysed. The plaintext is not kept,
+// decrypt it with repeating_key_XOR_stream in a second pass.
+class StreamingCracker
+{
+  public:
+    // Bytes of the input that are sampled or skipped together
+    static const size_t SAMPLE_BLOCK = 1 << 16;
+
+    StreamingCracker(size_t min_key_size, size_t max_key_size, size_t sample_every = 1,
+                     size_t solved_key_sizes = 2)
+        : min_(std::max<size_t>(min_key_size, 1)), max_(max_key_size), sample_every_(sample_every),
+          count_(solved_key_sizes)
+    {
+        if (max_ < min_)
+            throw std::logic_error("Invalid key size range");
+        if (sample_every_ == 0)
+            throw std::logic_error("Sampling rate cannot be zero");
+        bits_.assign(max_ - min_ + 1, 0);
+        pairs_.assign(max_ - min_ + 1, 0);
+        history_.reserve(2 * max_);
+    }
+
+    void update(const byte *data, size_t n)
+    {
+        while (n > 0)
+        {
+            uint64_t block = position_ / SAMPLE_BLOCK;
+            uint64_t block_end = (block + 1) * SAMPLE_BLOCK;
+            size_t m = static_cast<size_t>(std::min<uint64_t>(n, block_end - position_));
+            if (block % sample_every_ == 0)
+                add(data, m);
+            else
+                history_.clear();
+            position_ += m;
+            data += m;
+            n -= m;
+            // The first block is always sampled
+            if (position_ == SAMPLE_BLOCK)
+                choose_key_sizes();
+        }
+    }
+
+    // Bytes fed so far, and how many of them were analysed
+    uint64_t size() const { return position_; }
+    uint64_t sampled() const { return sampled_; }
+
+    // The count most likely key sizes over all the bytes analysed, as key_size::estimate ranks
+    // them
+    std::vector<key_size::Estimate> key_sizes(size_t count) const
+    {
+        std::vector<key_size::Estimate> estimates;
+        for (size_t k = min_; k <= max_; k++)
+        {
+            uint64_t pairs = pairs_[k - min_];
+            double distance = pairs > 0 ? static_cast<double>(bits_[k - min_]) /
+                                              static_cast<double>(pairs)
+                                        : std::numeric_limits<double>::infinity();
+            estimates.push_back({k, distance, static_cast<size_t>(pairs)});
+        }
+        return key_size::rank(std::move(estimates), count);
+    }
+
+    // The keys of the key sizes picked from the first block, highest score first. The score is
+    // the score of the bytes analysed from the first block on, and the plaintexts are left empty
+    std::vector<Candidate> candidates(const int (&weights)[256]) const
+    {
+        const single_byte_xor::KeyScorer scorer(weights);
+        std::vector<Candidate> result;
+        if (position_ < SAMPLE_BLOCK)
+        {
+            // The input ended within the first block, which is still held
+            for (const auto &estimate : key_sizes(count_))
+            {
+                if (estimate.key_size <= first_block_.size())
+                {
+                    auto h = columns::histograms(first_block_, estimate.key_size);
+                    result.push_back(solve(estimate.key_size, h.data(), scorer));
+                }
+            }
+        }
+        for (size_t i = 0; i < chosen_.size(); i++)
+            result.push_back(solve(chosen_[i], &histograms_[first_[i]], scorer));
+        detail::rank_candidates(result);
+        return result;
+    }
+
+  private:
+    static Candidate solve(size_t key_size, const single_byte_xor::Histogram *h,
+                           const single_byte_xor::KeyScorer &scorer)
+    {
+        Candidate candidate{bytes(), key_size, 0, bytes()};
+        for (size_t c = 0; c < key_size; c++)
+        {
+            auto best = single_byte_xor::best_key(scorer.score_keys(h[c]));
+            candidate.key.push_back(best.key);
+            candidate.score += best.score;
+        }
+        return candidate;
+    }
+
+    // Keeps the most likely key sizes of the first block, and counts their columns in it
+    void choose_key_sizes()
+    {
+        for (const auto &estimate : key_sizes(count_))
+        {
+            if (estimate.key_size > first_block_.size())
+                continue;
+            chosen_.push_back(estimate.key_size);
+            first_.push_back(histograms_.size());
+            histograms_.resize(histograms_.size() + estimate.key_size,
+                               single_byte_xor::Histogram{});
+            columns::add_to_histograms(first_block_.data(), first_block_.size(), estimate.key_size,
+                                       0, &histograms_[first_.back()]);
+        }
+        bytes().swap(first_block_);
+    }
+
+    // Adds bytes that directly follow the bytes in history_
+    void add(const byte *data, size_t n)
+    {
+        sampled_ += n;
+        if (position_ < SAMPLE_BLOCK)
+            first_block_.insert(first_block_.end(), data, data + n);
+        for (size_t i = 0; i < chosen_.size(); i++)
+        {
+            size_t k = chosen_[i];
+            columns::add_to_histograms(data, n, k, static_cast<size_t>(position_ % k),
+                                       &histograms_[first_[i]]);
+        }
+
+        // Pairs that start in the history, then pairs within data
+        size_t h = history_.size();
+        history_.insert(history_.end(), data, data + std::min(n, max_));
+        for (size_t k = min_; k <= max_; k++)
+        {
+            size_t begin = h > k ? h - k : 0;
+            size_t end = std::min(h, h + n > k ? h + n - k : 0);
+            if (end > begin)
+            {
+                bits_[k - min_] += hamming::distance(&history_[begin], &history_[begin + k],
+                                                     end - begin);
+                pairs_[k - min_] += end - begin;
+            }
+            if (n > k)
+            {
+                bits_[k - min_] += hamming::distance(data, data + k, n - k);
+                pairs_[k - min_] += n - k;
+            }
+        }
+
+        // Only the last max_ bytes are needed for the next chunk
+        if (n >= max_)
+            history_.assign(data + n - max_, data + n);
+        else if (history_.size() > max_)
+            history_.erase(history_.begin(),
+                           history_.begin() + static_cast<std::ptrdiff_t>(history_.size() - max_));
+    }
+
+    size_t min_, max_, sample_every_, count_;
+    uint64_t position_ = 0;
+    uint64_t sampled_ = 0;
+    // Differing bits and number of pairs of bytes k apart
+    std::vector<uint64_t> bits_;
+    std::vector<uint64_t> pairs_;
+    // The last bytes analysed, when they directly precede the next ones
+    bytes history_;
+    // The first block, until the key sizes are picked from it
+    bytes first_block_;
+    // The key sizes picked from the first block. The histograms of the columns of chosen_[i]
+    // start at first_[i]
+    std::vector<size_t> chosen_;
+    std::vector<single_byte_xor::Histogram> histograms_;
+    std::vector<size_t> first_;
+};
+
+} // namespace repeating_key_xor
@@ -0,0 +1,83 @@
+#pragma once
+#include "crypto.hpp"
+
+// Scores how much a text looks like a natural language. Higher the score of a text, higher the
+// probability that it is a piece of text in that language. The letters of the profile and the space
+// score by their rank in it, the most frequent highest. Other alphanumeric characters and
+// whitespace score 1, except digits which score 2, punctuation scores 0, and control characters and
+// bytes from 127 up score -1.
+//
+// The table of a language is built at compile time, so the score of a text is a single lookup per
+// character, nothing has to be initialized at startup and any number of threads can share it.
+namespace score
+{
+// A language profile lists its letters (and the space) from the most to the least frequent
+struct English
+{
+    static constexpr const char *frequency() { return " etaoinshrdlcumwfgypbvkjxqz"; }
+};
+
+struct German
+{
+    static constexpr const char *frequency() { return " enisratdhulcgmobwfkzpvjyxq"; }
+};
+
+namespace detail
+{
+// Assuming ASCII, like the "C" locale
+constexpr bool is_alnum(int ch)
+{
+    return ('0' <= ch && ch <= '9') || ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z');
+}
+
+constexpr bool is_space(int ch) { return ch == ' ' || ('\t' <= ch && ch <= '\r'); }
+
+constexpr bool is_special_or_digit(int ch)
+{
+    return ('0' <= ch && ch <= '9') || (33 <= ch && ch <= 64) || (91 <= ch && ch <= 96) ||
+           (123 <= ch && ch <= 126);
+}
+
+constexpr int to_upper(int ch) { return 'a' <= ch && ch <= 'z' ? ch - 'a' + 'A' : ch; }
+} // namespace detail
+
+template <typename Profile> struct Table
+{
+    int v[256];
+
+    constexpr Table() : v()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            v[i] = detail::is_alnum(i) || detail::is_space(i) ? 1 : -1;
+            // Special characters and digits get their -1 back
+            v[i] += detail::is_special_or_digit(i);
+        }
+        const char *frequency = Profile::frequency();
+        int n = 0;
+        while (frequency[n] != '\0')
+            n++;
+        for (int i = 0; i < n; i++)
+        {
+            auto ch = static_cast<byte>(frequency[i]);
+            v[ch] = v[detail::to_upper(ch)] = n - i;
+        }
+    }
+};
+
+template <typename Profile> constexpr Table<Profile> TABLE{};
+
+template <typename Profile = English> inline int64_t score(const byte *text, size_t n)
+{
+    const int *table = TABLE<Profile>.v;
+    int64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += table[text[i]];
+    return total;
+}
+
+template <typename Profile = English, typename T> inline int64_t score(const T &text)
+{
+    return score<Profile>(::detail::container_data(text), text.size());
+}
+} // namespace score
@@ -0,0 +1,251 @@
+#pragma once
+#include "crypto.hpp"
+#include <algorithm>
+#include <array>
+#include <vector>
+
+// Recovers the key of a text XORed with a single byte.
+//
+// The score of a candidate plaintext is the sum of weights[c] over its characters c, so the score
+// of key k is the sum over every byte value v of count(v) * weights[v ^ k]. One histogram of the
+// ciphertext is therefore enough to score all 256 keys, without XORing the text 256 times.
+//
+// That sum is a XOR convolution of the histogram with the weights, which the Walsh-Hadamard
+// transform turns into a product: scores = H(H(count) * H(weights)) / 256. With the transformed
+// weights computed once, scoring all keys costs two transforms of 256 values, whatever the length
+// of the text. Histograms with only a few distinct values are still scored directly.
+namespace single_byte_xor
+{
+using Histogram = std::array<uint64_t, 256>;
+using Scores = std::array<int64_t, 256>;
+
+struct Candidate
+{
+    byte key;
+    int64_t score;
+};
+
+struct Result
+{
+    byte key;
+    int64_t score;
+    bytes plaintext;
+};
+
+inline Histogram histogram(const byte *data, size_t n)
+{
+    Histogram h{};
+    if (n < 256)
+    {
+        for (size_t i = 0; i < n; i++)
+            h[data[i]]++;
+        return h;
+    }
+    // Four partial histograms, so that runs of equal bytes do not wait on the same counter
+    uint32_t partial[4][256] = {{0}};
+    while (n > 0)
+    {
+        // Flush before the 32 bit counters could overflow
+        size_t m = std::min<size_t>(n, static_cast<size_t>(1) << 30);
+        size_t i = 0;
+        for (; i + 4 <= m; i += 4)
+        {
+            partial[0][data[i]]++;
+            partial[1][data[i + 1]]++;
+            partial[2][data[i + 2]]++;
+            partial[3][data[i + 3]]++;
+        }
+        for (; i < m; i++)
+            partial[0][data[i]]++;
+        for (int v = 0; v < 256; v++)
+        {
+            h[v] += uint64_t{partial[0][v]} + partial[1][v] + partial[2][v] + partial[3][v];
+            partial[0][v] = partial[1][v] = partial[2][v] = partial[3][v] = 0;
+        }
+        data += m;
+        n -= m;
+    }
+    return h;
+}
+
+namespace detail
+{
+// The first three levels of the transform stay within groups of eight values
+inline void walsh_hadamard_8(int64_t *x)
+{
+    for (int i = 0; i < 256; i += 8)
+    {
+        int64_t *y = x + i;
+        int64_t a0 = y[0] + y[1], a1 = y[0] - y[1], a2 = y[2] + y[3], a3 = y[2] - y[3];
+        int64_t a4 = y[4] + y[5], a5 = y[4] - y[5], a6 = y[6] + y[7], a7 = y[6] - y[7];
+        int64_t b0 = a0 + a2, b1 = a1 + a3, b2 = a0 - a2, b3 = a1 - a3;
+        int64_t b4 = a4 + a6, b5 = a5 + a7, b6 = a4 - a6, b7 = a5 - a7;
+        y[0] = b0 + b4, y[1] = b1 + b5, y[2] = b2 + b6, y[3] = b3 + b7;
+        y[4] = b0 - b4, y[5] = b1 - b5, y[6] = b2 - b6, y[7] = b3 - b7;
+    }
+}
+
+// In place, unnormalized Walsh-Hadamard transform of 256 values. Applying it twice multiplies the
+// values by 256
+inline void walsh_hadamard_scalar(int64_t *x)
+{
+    walsh_hadamard_8(x);
+    for (int len = 8; len < 256; len *= 2)
+    {
+        for (int i = 0; i < 256; i += 2 * len)
+        {
+            int64_t *lo = x + i;
+            int64_t *hi = x + i + len;
+            for (int j = 0; j < len; j++)
+            {
+                int64_t a = lo[j];
+                int64_t b = hi[j];
+                lo[j] = a + b;
+                hi[j] = a - b;
+            }
+        }
+    }
+}
+
+#if CRYPTO_X86_SIMD
+__attribute__((target("avx2"))) inline void walsh_hadamard_avx2(int64_t *x)
+{
+    walsh_hadamard_8(x);
+    for (int len = 8; len < 256; len *= 2)
+    {
+        for (int i = 0; i < 256; i += 2 * len)
+        {
+            auto lo = reinterpret_cast<__m256i *>(x + i);
+            auto hi = reinterpret_cast<__m256i *>(x + i + len);
+            for (int j = 0; j < len / 4; j++)
+            {
+                __m256i a = _mm256_loadu_si256(lo + j);
+                __m256i b = _mm256_loadu_si256(hi + j);
+                _mm256_storeu_si256(lo + j, _mm256_add_epi64(a, b));
+                _mm256_storeu_si256(hi + j, _mm256_sub_epi64(a, b));
+            }
+        }
+    }
+}
+#endif
+
+inline void walsh_hadamard(int64_t *x)
+{
+#if CRYPTO_X86_SIMD
+    static const bool avx2 = cpu::features().avx2;
+    if (avx2)
+        return walsh_hadamard_avx2(x);
+#endif
+    walsh_hadamard_scalar(x);
+}
+
+// Up to this many distinct byte values, scoring them one by one is cheaper than the transforms
+const int SPARSE_LIMIT = 16;
+} // namespace detail
+
+// Scores all keys with one weight table. Reuse it to score many texts with the same weights
+class KeyScorer
+{
+  public:
+    explicit KeyScorer(const int (&weights)[256]) : weights_(weights)
+    {
+        for (int c = 0; c < 256; c++)
+            spectrum_[c] = weights[c];
+        detail::walsh_hadamard(spectrum_);
+    }
+
+    // The score of every key, given the histogram of the ciphertext
+    Scores score_keys(const Histogram &h) const
+    {
+        int distinct = 0;
+        for (int v = 0; v < 256; v++)
+            distinct += h[v] != 0;
+
+        Scores scores{};
+        if (distinct <= detail::SPARSE_LIMIT)
+        {
+            for (int v = 0; v < 256; v++)
+            {
+                if (h[v] == 0)
+                    continue;
+                auto count = static_cast<int64_t>(h[v]);
+                for (int k = 0; k < 256; k++)
+                    scores[k] += count * weights_[v ^ k];
+            }
+            return scores;
+        }
+        for (int v = 0; v < 256; v++)
+            scores[v] = static_cast<int64_t>(h[v]);
+        detail::walsh_hadamard(scores.data());
+        for (int v = 0; v < 256; v++)
+            scores[v] *= spectrum_[v];
+        detail::walsh_hadamard(scores.data());
+        for (auto &score : scores)
+            score /= 256;
+        return scores;
+    }
+
+  private:
+    const int (&weights_)[256];
+    int64_t spectrum_[256];
+};
+
+inline Scores score_keys(const Histogram &h, const int (&weights)[256])
+{
+    return KeyScorer(weights).score_keys(h);
+}
+
+// The best count keys, highest score first. Equal scores are ordered by key
+inline std::vector<Candidate> rank_keys(const Scores &scores, size_t count)
+{
+    std::vector<Candidate> candidates(256);
+    for (int k = 0; k < 256; k++)
+        candidates[k] = {static_cast<byte>(k), scores[k]};
+    count = std::min<size_t>(count, 256);
+    std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(count),
+                      candidates.end(), [](const Candidate &a, const Candidate &b) {
+                          return a.score != b.score ? a.score > b.score : a.key < b.key;
+                      });
+    candidates.resize(count);
+    return candidates;
+}
+
+// The key with the highest score, the lowest one if several have the same score
+inline Candidate best_key(const Scores &scores)
+{
+    Candidate best{0, scores[0]};
+    for (int k = 1; k < 256; k++)
+    {
+        if (scores[k] > best.score)
+            best = {static_cast<byte>(k), scores[k]};
+    }
+    return best;
+}
+
+inline std::vector<Candidate> top_keys(const byte *data, size_t n, const int (&weights)[256],
+                                       size_t count)
+{
+    return rank_keys(score_keys(histogram(data, n), weights), count);
+}
+
+template <typename T>
+inline std::vector<Candidate> top_keys(const T &text, const int (&weights)[256], size_t count)
+{
+    return top_keys(::detail::container_data(text), text.size(), weights, count);
+}
+
+// Finds the key with the highest score, and decrypts the text with it
+inline Result solve(const byte *data, size_t n, const int (&weights)[256])
+{
+    Candidate best = best_key(score_keys(histogram(data, n), weights));
+    bytes plaintext(n);
+    for (size_t i = 0; i < n; i++)
+        plaintext[i] = data[i] ^ best.key;
+    return {best.key, best.score, std::move(plaintext)};
+}
+
+template <typename T> inline Result solve(const T &text, const int (&weights)[256])
+{
+    return solve(::detail::container_data(text), text.size(), weights);
+}
+} // namespace single_byte_xor
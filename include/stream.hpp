@@ -0,0 +1,491 @@
+#pragma once
+#include "crypto.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <istream>
+#include <ostream>
+#include <system_error>
+#include <unistd.h>
+
+// Incremental versions of the hex and base64 codecs. Input can be fed in chunks of any size, the
+// partial nibbles / groups at the end of a chunk are carried over to the next one. The output is
+// written to a buffer supplied by the caller, which must have room for max_output_size(n) bytes.
+//
+// The decoders skip whitespace, so line wrapped (MIME style) input can be decoded directly.
+// Every codec has the same interface:
+//   size_t max_output_size(size_t n) const;
+//   size_t update(const byte *in, size_t n, byte *out);   returns the number of bytes written
+//   size_t finish(byte *out);                              flushes / validates the end of input
+
+namespace detail
+{
+inline bool is_space(byte ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t' || ch == '\v' || ch == '\f';
+}
+
+// Returns the position of the first whitespace character, or n if there is none
+inline size_t find_space(const byte *in, size_t n)
+{
+    size_t i = 0;
+#if CRYPTO_X86_SIMD && defined(__SSE2__)
+    // Every whitespace character is <= ' ', so only those bytes need a closer look
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        unsigned mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, space), x)));
+        for (; mask != 0; mask &= mask - 1)
+        {
+            size_t j = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (is_space(in[j]))
+                return j;
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        if (is_space(in[i]))
+            return i;
+    }
+    return n;
+}
+
+// Calls process(run, length) for every maximal run of non whitespace characters
+template <typename Process> inline void for_each_run(const byte *in, size_t n, Process process)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        if (is_space(in[i]))
+        {
+            i++;
+            continue;
+        }
+        size_t length = find_space(in + i, n - i);
+        process(in + i, length);
+        i += length;
+    }
+}
+
+// Size of the buffers used by the stream functions, the memory used does not depend on the input
+const size_t STREAM_CHUNK_SIZE = 1 << 16;
+
+template <typename Codec, typename Read, typename Write>
+inline uint64_t transcode(Codec &codec, Read read, Write write)
+{
+    bytes in(STREAM_CHUNK_SIZE);
+    bytes out(codec.max_output_size(STREAM_CHUNK_SIZE));
+    uint64_t total = 0;
+    size_t n;
+    while ((n = read(in.data(), in.size())) > 0)
+    {
+        size_t written = codec.update(in.data(), n, out.data());
+        write(out.data(), written);
+        total += written;
+    }
+    size_t written = codec.finish(out.data());
+    write(out.data(), written);
+    return total + written;
+}
+
+// Reads up to n bytes, returns 0 at the end of the stream
+inline size_t read_some(std::istream &is, byte *buffer, size_t n)
+{
+    is.read(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(n));
+    if (is.bad())
+        throw std::runtime_error("Could not read from the input stream");
+    return static_cast<size_t>(is.gcount());
+}
+
+inline size_t read_some(int fd, byte *buffer, size_t n)
+{
+    ssize_t r;
+    while ((r = ::read(fd, buffer, n)) < 0)
+    {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "read");
+    }
+    return static_cast<size_t>(r);
+}
+
+// Reads until the buffer is full or the stream ends
+template <typename Source> inline size_t read_full(Source &source, byte *buffer, size_t n)
+{
+    size_t total = 0;
+    size_t r;
+    while (total < n && (r = read_some(source, buffer + total, n - total)) > 0)
+        total += r;
+    return total;
+}
+
+inline void write_all(std::ostream &os, const byte *buffer, size_t n)
+{
+    os.write(reinterpret_cast<const char *>(buffer), static_cast<std::streamsize>(n));
+    if (!os)
+        throw std::runtime_error("Could not write to the output stream");
+}
+
+inline void write_all(int fd, const byte *buffer, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = ::write(fd, buffer, n);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        buffer += w;
+        n -= static_cast<size_t>(w);
+    }
+}
+
+template <typename Codec>
+inline uint64_t transcode(Codec &codec, std::istream &is, std::ostream &os)
+{
+    auto read = [&is](byte *buffer, size_t n) { return read_some(is, buffer, n); };
+    auto write = [&os](const byte *buffer, size_t n) { write_all(os, buffer, n); };
+    return transcode(codec, read, write);
+}
+
+template <typename Codec> inline uint64_t transcode(Codec &codec, int in_fd, int out_fd)
+{
+    auto read = [in_fd](byte *buffer, size_t n) { return read_some(in_fd, buffer, n); };
+    auto write = [out_fd](const byte *buffer, size_t n) { write_all(out_fd, buffer, n); };
+    return transcode(codec, read, write);
+}
+
+// Source is an std::istream or a file descriptor, Sink an std::ostream or a file descriptor
+template <typename Source, typename Sink>
+inline uint64_t fixed_XOR_stream(Source &a, Source &b, Sink &out)
+{
+    bytes buffer_a(STREAM_CHUNK_SIZE);
+    bytes buffer_b(STREAM_CHUNK_SIZE);
+    uint64_t total = 0;
+    while (true)
+    {
+        size_t n = read_full(a, buffer_a.data(), buffer_a.size());
+        bool last = n < buffer_a.size();
+        // At the end of a, b must end too
+        bool mismatch = read_full(b, buffer_b.data(), n) != n;
+        if (mismatch || (last && read_some(b, buffer_b.data(), 1) != 0))
+            throw std::runtime_error("Streams are not of equal size");
+        xor_bytes(buffer_a.data(), buffer_b.data(), n, buffer_a.data());
+        write_all(out, buffer_a.data(), n);
+        total += n;
+        if (last)
+            return total;
+    }
+}
+} // namespace detail
+
+// XORs two streams of the same length into out, one chunk at a time, and returns the number of
+// bytes written. Throws if one stream ends before the other
+inline uint64_t fixed_XOR_stream(std::istream &a, std::istream &b, std::ostream &out)
+{
+    return detail::fixed_XOR_stream(a, b, out);
+}
+
+inline uint64_t fixed_XOR_stream(int a_fd, int b_fd, int out_fd)
+{
+    return detail::fixed_XOR_stream(a_fd, b_fd, out_fd);
+}
+
+// XORs a whole stream with a repeating key, and returns the number of bytes written
+template <typename Key>
+inline uint64_t repeating_key_XOR_stream(std::istream &is, std::ostream &os, const Key &key)
+{
+    RepeatingKeyXOR engine(key);
+    return detail::transcode(engine, is, os);
+}
+
+template <typename Key>
+inline uint64_t repeating_key_XOR_stream(int in_fd, int out_fd, const Key &key)
+{
+    RepeatingKeyXOR engine(key);
+    return detail::transcode(engine, in_fd, out_fd);
+}
+
+namespace hex
+{
+class Encoder
+{
+  public:
+    size_t max_output_size(size_t n) const { return 2 * n; }
+
+    size_t update(const byte *in, size_t n, byte *out)
+    {
+        detail::encode(in, n, out);
+        return 2 * n;
+    }
+
+    size_t finish(byte *) { return 0; }
+};
+
+class Decoder
+{
+  public:
+    // One character may be left over from the previous call
+    size_t max_output_size(size_t n) const { return (n + 1) / 2; }
+
+    size_t update(const byte *in, size_t n, byte *out)
+    {
+        byte *start = out;
+        ::detail::for_each_run(in, n, [this, &out](const byte *run, size_t length) {
+            consumed_ += length;
+            if (has_pending_)
+            {
+                *out++ = detail::decode_pair(pending_, run[0]);
+                has_pending_ = false;
+                run++;
+                length--;
+            }
+            size_t even = length & ~static_cast<size_t>(1);
+            detail::decode(run, even, out);
+            out += even / 2;
+            if (length % 2 != 0)
+            {
+                pending_ = run[length - 1];
+                if (detail::VALUE_TABLE.v[pending_] == detail::INVALID)
+                    detail::throw_invalid_character(pending_);
+                has_pending_ = true;
+            }
+        });
+        return static_cast<size_t>(out - start);
+    }
+
+    // Throws if the total number of characters was odd
+    size_t finish(byte *)
+    {
+        if (has_pending_)
+            detail::throw_invalid_length(consumed_);
+        consumed_ = 0;
+        return 0;
+    }
+
+  private:
+    byte pending_ = 0;
+    bool has_pending_ = false;
+    size_t consumed_ = 0;
+};
+
+inline uint64_t encode_stream(std::istream &is, std::ostream &os)
+{
+    Encoder encoder;
+    return ::detail::transcode(encoder, is, os);
+}
+
+inline uint64_t decode_stream(std::istream &is, std::ostream &os)
+{
+    Decoder decoder;
+    return ::detail::transcode(decoder, is, os);
+}
+
+inline uint64_t encode_stream(int in_fd, int out_fd)
+{
+    Encoder encoder;
+    return ::detail::transcode(encoder, in_fd, out_fd);
+}
+
+inline uint64_t decode_stream(int in_fd, int out_fd)
+{
+    Decoder decoder;
+    return ::detail::transcode(decoder, in_fd, out_fd);
+}
+} // namespace hex
+
+namespace base64
+{
+class Encoder
+{
+  public:
+    // If line_length is not zero, a newline is written after every line_length characters and at
+    // the end of the output. MIME uses 76 characters per line.
+    explicit Encoder(size_t line_length = 0) : line_length_(line_length)
+    {
+        if (line_length % 4 != 0)
+            throw std::logic_error("Base64 line length must be a multiple of four");
+    }
+
+    size_t max_output_size(size_t n) const
+    {
+        // Two bytes may be left over from the previous call
+        size_t characters = (n + 2 + 2) / 3 * 4;
+        return characters + (line_length_ != 0 ? characters / line_length_ + 1 : 0);
+    }
+
+    size_t update(const byte *in, size_t n, byte *out)
+    {
+        byte *start = out;
+        if (carry_length_ > 0)
+        {
+            while (carry_length_ < 3 && n > 0)
+            {
+                carry_[carry_length_++] = *in++;
+                n--;
+            }
+            if (carry_length_ < 3)
+                return 0;
+            out = put_groups(carry_, 1, out);
+            carry_length_ = 0;
+        }
+        size_t groups = n / 3;
+        out = put_groups(in, groups, out);
+        in += 3 * groups;
+        n -= 3 * groups;
+        if (n > 0)
+            memcpy(carry_, in, n);
+        carry_length_ = n;
+        return static_cast<size_t>(out - start);
+    }
+
+    // Writes the last, padded group
+    size_t finish(byte *out)
+    {
+        byte *start = out;
+        if (carry_length_ > 0)
+        {
+            detail::encode(carry_, carry_length_, out);
+            out += 4;
+            column_ += 4;
+            carry_length_ = 0;
+        }
+        if (line_length_ != 0 && column_ != 0)
+            *out++ = '\n';
+        column_ = 0;
+        return static_cast<size_t>(out - start);
+    }
+
+  private:
+    byte *put_groups(const byte *in, size_t groups, byte *out)
+    {
+        if (line_length_ == 0)
+        {
+            detail::encode(in, 3 * groups, out);
+            return out + 4 * groups;
+        }
+        while (groups > 0)
+        {
+            size_t g = std::min(groups, (line_length_ - column_) / 4);
+            detail::encode(in, 3 * g, out);
+            in += 3 * g;
+            out += 4 * g;
+            groups -= g;
+            column_ += 4 * g;
+            if (column_ == line_length_)
+            {
+                *out++ = '\n';
+                column_ = 0;
+            }
+        }
+        return out;
+    }
+
+    size_t line_length_;
+    size_t column_ = 0;
+    byte carry_[3] = {0};
+    size_t carry_length_ = 0;
+};
+
+class Decoder
+{
+  public:
+    // Three characters may be left over from the previous call
+    size_t max_output_size(size_t n) const { return (n + 3) / 4 * 3; }
+
+    size_t update(const byte *in, size_t n, byte *out)
+    {
+        byte *start = out;
+        ::detail::for_each_run(in, n, [this, &out](const byte *run, size_t length) {
+            // Nothing except whitespace may follow the padding
+            if (finished_)
+                detail::throw_invalid_padding();
+            consumed_ += length;
+
+            // Complete the group carried over from the previous run
+            while (group_length_ > 0 && length > 0)
+            {
+                group_[group_length_++] = *run++;
+                length--;
+                if (group_length_ == 4)
+                {
+                    out = put_groups(group_, 4, out);
+                    group_length_ = 0;
+                    if (finished_ && length > 0)
+                        detail::throw_invalid_padding();
+                }
+            }
+
+            size_t whole = length / 4 * 4;
+            out = put_groups(run, whole, out);
+            run += whole;
+            length -= whole;
+
+            if (length > 0)
+            {
+                if (finished_)
+                    detail::throw_invalid_padding();
+                memcpy(group_, run, length);
+                group_length_ = length;
+            }
+        });
+        return static_cast<size_t>(out - start);
+    }
+
+    // Throws if the input ended in the middle of a group
+    size_t finish(byte *)
+    {
+        if (group_length_ != 0)
+            detail::throw_invalid_length(consumed_);
+        consumed_ = 0;
+        finished_ = false;
+        return 0;
+    }
+
+  private:
+    // Decodes whole groups, only the last of which may be padded
+    byte *put_groups(const byte *in, size_t n, byte *out)
+    {
+        if (n == 0)
+            return out;
+        size_t length = detail::decoded_length(in, n);
+        detail::decode(in, n, out);
+        if (in[n - 1] == '=')
+            finished_ = true;
+        return out + length;
+    }
+
+    byte group_[4] = {0};
+    size_t group_length_ = 0;
+    size_t consumed_ = 0;
+    bool finished_ = false;
+};
+
+// Encodes without line breaks, unless line_length is given
+inline uint64_t encode_stream(std::istream &is, std::ostream &os, size_t line_length = 0)
+{
+    Encoder encoder(line_length);
+    return ::detail::transcode(encoder, is, os);
+}
+
+inline uint64_t decode_stream(std::istream &is, std::ostream &os)
+{
+    Decoder decoder;
+    return ::detail::transcode(decoder, is, os);
+}
+
+inline uint64_t encode_stream(int in_fd, int out_fd, size_t line_length = 0)
+{
+    Encoder encoder(line_length);
+    return ::detail::transcode(encoder, in_fd, out_fd);
+}
+
+inline uint64_t decode_stream(int in_fd, int out_fd)
+{
+    Decoder decoder;
+    return ::detail::transcode(decoder, in_fd, out_fd);
+}
+} // namespace base64
@@ -0,0 +1,117 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed size pool of worker threads. Tasks are run in the order they are submitted, and an
+// exception thrown by a task is passed on to whoever waits on its future.
+class ThreadPool
+{
+  public:
+    // Uses one thread per core if threads is zero
+    explicit ThreadPool(size_t threads = 0)
+    {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threads; i++)
+            workers_.emplace_back([this] { work(); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        for (auto &worker : workers_)
+            worker.join();
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    template <typename F> std::future<typename std::result_of<F()>::type> submit(F f)
+    {
+        using result_type = typename std::result_of<F()>::type;
+        auto task = std::make_shared<std::packaged_task<result_type()>>(std::move(f));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([task] { (*task)(); });
+        }
+        condition_.notify_one();
+        return future;
+    }
+
+    // Calls f(i) for every i in [0, n), spread over the workers, and waits until all calls have
+    // returned. The first exception thrown by f is rethrown here.
+    template <typename F> void parallel_for(size_t n, F f)
+    {
+        std::vector<std::future<void>> futures;
+        futures.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            futures.push_back(submit([&f, i] { f(i); }));
+        wait_all(futures);
+    }
+
+    // A pool shared by the whole program, with one thread per core
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+  private:
+    template <typename T> static void wait_all(std::vector<std::future<T>> &futures)
+    {
+        // Wait for every task before rethrowing, since they may refer to the caller's stack
+        std::exception_ptr error;
+        for (auto &future : futures)
+        {
+            try
+            {
+                future.get();
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty())
+                    return;
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stopping_ = false;
+};
@@ -1,5 +1,10 @@
 #include "crypto.hpp"
+#include "stream.hpp"
 #include "gtest/gtest.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
 
 TEST(Challenge2, solution)
@@ -20,6 +25,42 @@ TEST(Challenge2, solution)
 
 int main(int argc, char *argv[])
 {
+    // XORs two files of the same size: challenge2 xor <file1> <file2> <output>
+    if (argc == 5 && strcmp(argv[1], "xor") == 0)
+    {
+        int a = open(argv[2], O_RDONLY);
+        int b = open(argv[3], O_RDONLY);
+        int out = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int status = 0;
+        if (a < 0 || b < 0 || out < 0)
+        {
+            perror("open");
+            status = 1;
+        }
+        else
+        {
+            try
+            {
+                fixed_XOR_stream(a, b, out);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << std::endl;
+                status = 1;
+            }
+        }
+        if (a >= 0)
+            close(a);
+        if (b >= 0)
+            close(b);
+        // A write error can be reported only when the file is closed
+        if (out >= 0 && close(out) != 0)
+        {
+            perror("close");
+            status = 1;
+        }
+        return status;
+    }
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
\ No newline at end of file
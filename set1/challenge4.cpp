@@ -1,136 +1,64 @@
 #include "crypto.hpp"
-#include <fstream>
+#include "line_scanner.hpp"
+#include "score.hpp"
 #include <iostream>
 #include <iterator>
+#include <stdlib.h>
+#include <system_error>
 
-// Contains the frequency distribution for letters in english,
-// characters with lower index are more frequent
-static std::string frequency_dist = " etaoinshrdlcumwfgypbvkjxqz";
+// Number of candidate lines that are printed
+const size_t NUMBER_OF_LINES = 5;
 
-static int score_table[256] = {0};
-
-// This function must be called before using score_table
-void build_score_table()
-{
-    for (int i = 0; i < 256; i++)
-    {
-        if (isalnum(i) || isspace(i))
-            score_table[i] = 1;
-        else
-            score_table[i] = -1;
-    }
-    int i = static_cast<int>(frequency_dist.size());
-    for (const auto &ch : frequency_dist)
-    {
-        score_table[static_cast<byte>(ch)] = i;
-        score_table[static_cast<byte>(toupper(ch))] = i;
-        --i;
-    }
-}
-
-// Calculates a score for a sequence of bytes
-// Higher the score, higher the probability that it is a piece of english text
-// If a non alphanumeric character is found, the score is reduced
-
-bool is_special_or_digit(byte ch)
-{
-    // Assuming ASCII
-    return ('0' <= ch && ch <= '9') || (33 <= ch && ch <= 64) || (91 <= ch && ch <= 96) ||
-           (123 <= ch && ch <= 126);
-}
-
-int calculate_score(bytes &text)
-{
-    int final_score = 0;
-    int num_special = 0;
-    for (const auto &ch : text)
-    {
-        final_score += score_table[ch];
-        num_special += is_special_or_digit(ch);
-    }
-    // To remove all the minus ones
-    final_score += num_special;
-
-    return final_score;
-}
-
-bytes single_byte_XOR(const bytes &plaintext, byte key)
-{
-    bytes ciphertext;
-    ciphertext.reserve(plaintext.size());
-    for (const auto &b : plaintext)
-    {
-        ciphertext.push_back(b ^ key);
-    }
-    return ciphertext;
-}
-
-bytes decode(const std::string &hexstring, int &key, int &calculated_score)
+int main(int argc, char *argv[])
 {
-    auto byts = hex::to_bytes(hexstring);
-    int max_score = 0;
-    bytes english_plaintext;
+    // challenge4 [file] [threads]
+    std::string filename = argc >= 2 ? argv[1] : "challenge4.txt";
+    size_t threads = argc >= 3 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 0;
 
-    // Brute force, check all the bytes and print the one with the highest english score
-    for (int i = 0; i < 256; i++)
+    single_byte_xor::ScanResult result;
+    try
     {
-        auto plaintext = single_byte_XOR(byts, static_cast<byte>(i));
-        int score = calculate_score(plaintext);
-        if (score > max_score)
+        // Every line is scored on all cores, only the best lines are kept
+        ThreadPool pool(threads);
+        try
         {
-            max_score = score;
-            english_plaintext = plaintext;
-            key = i;
+            result = single_byte_xor::scan_hex_file(filename, score::TABLE<score::English>.v,
+                                                    NUMBER_OF_LINES, pool);
+        }
+        catch (const std::system_error &e)
+        {
+            // MappedFile could not open or map the file
+            std::cerr << "Could not open " << e.what() << std::endl;
+            return 1;
         }
     }
-
-    calculated_score = max_score;
-    return english_plaintext;
-}
-
-int main(int argc, char *argv[])
-{
-    std::string filename;
-    if (argc != 2)
-    {
-        filename = "challenge4.txt";
-    }
-    else
+    catch (const std::exception &e)
     {
-        filename = argv[1];
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
-    std::ifstream ifs(filename);
-    if (!ifs)
+    if (result.best.empty())
     {
-        std::cout << "Could not open " << filename << std::endl;
+        std::cout << "No hex encoded lines in " << filename << std::endl;
         return 1;
     }
-    build_score_table();
-    std::string line;
-
-    int max_score = 0;
-    int max_score_key = 0;
-    bytes possible_plaintext;
-    std::string possible_ciphertext;
 
-    while (std::getline(ifs, line))
-    {
-        int key = 0, score = 0;
-        auto decoded = decode(line, key, score);
-        if (score > max_score)
-        {
-            max_score = score;
-            max_score_key = key;
-            possible_plaintext = decoded;
-            possible_ciphertext = line;
-        }
-    }
+    const auto &best = result.best.front();
     std::cout << "Among the given lines, " << std::endl;
-    std::cout << possible_ciphertext << std::endl;
-    std::cout << "Is likely to be XOR encrypted with key " << max_score_key << " and has a score "
-              << max_score << std::endl;
+    std::cout << "Line " << best.line + 1 << std::endl;
+    std::cout << "Is likely to be XOR encrypted with key " << static_cast<int>(best.key)
+              << " and has a score " << best.score << std::endl;
     std::cout << "Plaintext: ";
-    std::copy(possible_plaintext.begin(), possible_plaintext.end(),
-              std::ostream_iterator<byte>(std::cout));
+    std::copy(best.plaintext.begin(), best.plaintext.end(), std::ostream_iterator<byte>(std::cout));
     std::cout << std::endl;
+
+    std::cout << std::endl << "Best lines:" << std::endl;
+    for (const auto &match : result.best)
+    {
+        std::cout << "[" << match.line + 1 << "] key " << static_cast<int>(match.key) << ", score "
+                  << match.score << std::endl;
+    }
+    std::cout << "Scanned " << result.stats.lines << " lines (" << result.stats.invalid_lines
+              << " invalid), " << result.stats.bytes << " bytes in " << result.stats.seconds
+              << " s, " << result.stats.bytes_per_second() / 1e6 << " MB/s" << std::endl;
 }
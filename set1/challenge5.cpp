@@ -1,33 +1,12 @@
 #include "crypto.hpp"
+#include "stream.hpp"
 #include "gtest/gtest.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
 #include <stdexcept>
-
-template <typename PlainIter, typename KeyIter>
-bytes repeating_key_XOR(PlainIter pbeg, PlainIter pend, KeyIter kbeg, KeyIter kend)
-{
-    if (kbeg == kend)
-    {
-        throw std::logic_error("Key cannot be empty");
-    }
-    bytes result;
-    auto key_iter = kbeg;
-
-    for (; pbeg != pend; pbeg++)
-    {
-        byte key = static_cast<byte>(*key_iter++);
-        result.push_back(static_cast<byte>(key ^ static_cast<byte>((*pbeg))));
-        if (key_iter == kend)
-            key_iter = kbeg;
-    }
-    return result;
-}
-
-template <typename PlainText, typename CipherText>
-bytes repeating_key_XOR(const PlainText &p, const CipherText c)
-{
-    return repeating_key_XOR(std::begin(p), std::end(p), std::begin(c), std::end(c));
-}
+#include <unistd.h>
 
 TEST(Challenge5, solution)
 {
@@ -50,6 +29,38 @@ int main(int argc, char *argv[])
 {
     if (argc >= 2)
     {
+        // Encrypts / decrypts a whole file: challenge5 file <key> <input> <output>
+        if (argc == 5 && strcmp(argv[1], "file") == 0)
+        {
+            int in = open(argv[3], O_RDONLY);
+            int out = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            int status = 0;
+            if (in < 0 || out < 0)
+            {
+                perror("open");
+                status = 1;
+            }
+            else
+            {
+                try
+                {
+                    repeating_key_XOR_stream(in, out, std::string(argv[2]));
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << e.what() << std::endl;
+                    status = 1;
+                }
+            }
+            if (in >= 0)
+                close(in);
+            if (out >= 0 && close(out) != 0)
+            {
+                perror("close");
+                status = 1;
+            }
+            return status;
+        }
         if (strcmp(argv[1], "encrypt") == 0)
         {
             std::string plaintext, key, line;
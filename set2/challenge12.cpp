@@ -11,10 +11,13 @@ std::string unknown_string =
 // A random key
 bytes key = {190, 153, 206, 182, 196, 74, 119, 85, 195, 88, 4, 88, 76, 157, 28, 14};
 
+// The oracle is called thousands of times, the key schedule is computed only once
+const Aes128 cipher(key);
+
 bytes encrypt(const bytes &buffer)
 {
     // Encrypts a buffer using a random but consistent key
-    return aes128_encrypt_ecb(buffer, key);
+    return cipher.encrypt_ecb(buffer);
 }
 
 // Encrypts the buffer after appending an unknown string
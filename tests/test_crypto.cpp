@@ -1,5 +1,23 @@
+#include "batch_scorer.hpp"
+#include "bulk.hpp"
+#include "columns.hpp"
 #include "crypto.hpp"
+#include "distance_matrix.hpp"
+#include "hamming.hpp"
+#include "key_size.hpp"
+#include "line_scanner.hpp"
+#include "parallel_aes.hpp"
+#include "period.hpp"
+#include "repeating_key_xor.hpp"
+#include "score.hpp"
+#include "single_byte_xor.hpp"
+#include "stream.hpp"
 #include "gtest/gtest.h"
+#include <list>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <thread>
 
 TEST(Hex, from_bytes_empty) { EXPECT_EQ(hex::from_bytes(bytes()), bytes()); }
 
@@ -43,6 +61,111 @@ TEST(Hex, to_bytes)
     EXPECT_EQ(result, expected);
 }
 
+TEST(Hex, to_bytes_invalid_letters)
+{
+    EXPECT_THROW(hex::to_bytes(std::string("0g")), std::runtime_error);
+    EXPECT_THROW(hex::to_bytes(std::string("zz")), std::runtime_error);
+    EXPECT_THROW(hex::to_bytes(std::string("ab ")), std::runtime_error);
+}
+
+TEST(Hex, to_bytes_uppercase)
+{
+    bytes expected = {0xab, 0xcd, 0xef};
+    EXPECT_EQ(hex::to_bytes(std::string("ABCDEF")), expected);
+    EXPECT_EQ(hex::to_bytes(std::string("aBcDeF")), expected);
+}
+
+// Builds random data long enough to pass through every vector width plus an unaligned tail
+static bytes random_bytes(size_t n, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    bytes b(n);
+    for (auto &x : b)
+        x = static_cast<byte>(rng());
+    return b;
+}
+
+TEST(Hex, round_trip_all_lengths)
+{
+    for (size_t n = 0; n < 300; n++)
+    {
+        bytes b = random_bytes(n, static_cast<unsigned>(n));
+        bytes encoded = hex::from_bytes(b);
+        ASSERT_EQ(encoded.size(), 2 * n);
+        // The generic (non contiguous) path must agree with the vectorized one
+        std::list<byte> as_list(b.begin(), b.end());
+        ASSERT_EQ(hex::from_bytes(as_list), encoded);
+        ASSERT_EQ(hex::to_bytes(encoded), b);
+        std::list<byte> encoded_list(encoded.begin(), encoded.end());
+        ASSERT_EQ(hex::to_bytes(encoded_list), b);
+    }
+}
+
+TEST(Hex, invalid_character_at_every_position)
+{
+    bytes encoded = hex::from_bytes(random_bytes(100, 7));
+    for (size_t i = 0; i < encoded.size(); i++)
+    {
+        bytes bad = encoded;
+        bad[i] = 'x';
+        ASSERT_THROW(hex::to_bytes(bad), std::runtime_error);
+        bad[i] = 0x80;
+        ASSERT_THROW(hex::to_bytes(bad), std::runtime_error);
+    }
+    encoded.push_back('0');
+    EXPECT_THROW(hex::to_bytes(encoded), std::runtime_error);
+}
+
+#if CRYPTO_X86_SIMD
+// Runs every kernel that the CPU supports against the scalar version
+TEST(Hex, simd_kernels)
+{
+    std::vector<hex::detail::kernel> decoders, encoders;
+    if (cpu::features().ssse3)
+    {
+        decoders.push_back(hex::detail::decode_ssse3);
+        encoders.push_back(hex::detail::encode_ssse3);
+    }
+    if (cpu::features().avx2)
+    {
+        decoders.push_back(hex::detail::decode_avx2);
+        encoders.push_back(hex::detail::encode_avx2);
+    }
+    if (cpu::features().avx512bw)
+    {
+        decoders.push_back(hex::detail::decode_avx512);
+        encoders.push_back(hex::detail::encode_avx512);
+    }
+
+    bytes b = random_bytes(1000, 42);
+    bytes expected(2 * b.size());
+    hex::detail::encode_scalar(b.data(), b.size(), expected.data());
+    for (auto encode : encoders)
+    {
+        bytes out(2 * b.size());
+        size_t done = encode(b.data(), b.size(), out.data());
+        ASSERT_GT(done, 0);
+        ASSERT_TRUE(std::equal(out.begin(), out.begin() + 2 * done, expected.begin()));
+    }
+
+    // Mix upper and lower case in the input
+    for (size_t i = 0; i < expected.size(); i += 3)
+        expected[i] = static_cast<byte>(toupper(expected[i]));
+    for (auto decode : decoders)
+    {
+        bytes out(b.size());
+        size_t done = decode(expected.data(), b.size(), out.data());
+        ASSERT_GT(done, 0);
+        ASSERT_TRUE(std::equal(out.begin(), out.begin() + done, b.begin()));
+
+        // A kernel must stop before a block with an invalid character
+        bytes bad = expected;
+        bad[10] = 'g';
+        ASSERT_LE(decode(bad.data(), b.size(), out.data()), 5);
+    }
+}
+#endif
+
 TEST(Base64, from_bytes_empty) { EXPECT_EQ(hex::to_bytes(std::string("")), bytes()); }
 
 TEST(Base64, from_bytes_simple)
@@ -76,6 +199,1293 @@ TEST(Base64, from_bytes_simple)
     EXPECT_EQ(result, expected);
 }
 
+TEST(Base64, to_bytes_simple)
+{
+    auto as_string = [](const bytes &b) { return std::string(b.begin(), b.end()); };
+    EXPECT_EQ(base64::to_bytes(std::string("")), bytes());
+    EXPECT_EQ(as_string(base64::to_bytes(std::string("TWFu"))), "Man");
+    EXPECT_EQ(as_string(base64::to_bytes(std::string("TWE="))), "Ma");
+    EXPECT_EQ(as_string(base64::to_bytes(std::string("TQ=="))), "M");
+    EXPECT_EQ(as_string(base64::to_bytes(std::string(
+                  "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZ3M="))),
+              "The quick brown fox jumps over the lazy dogs");
+    EXPECT_EQ(base64::to_bytes(std::string("AA==")), bytes({0}));
+    EXPECT_EQ(base64::to_bytes(std::string("+/+/")), bytes({0xfb, 0xff, 0xbf}));
+}
+
+TEST(Base64, to_bytes_error)
+{
+    // Length is not a multiple of four
+    EXPECT_THROW(base64::to_bytes(std::string("TWF")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("TWFuT")), std::runtime_error);
+    // Characters outside the alphabet
+    EXPECT_THROW(base64::to_bytes(std::string("TW-u")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("TW u")), std::runtime_error);
+    // Padding in the wrong place
+    EXPECT_THROW(base64::to_bytes(std::string("TW=u")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("T===")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("====")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("TQ==TWFu")), std::runtime_error);
+    // Non zero bits after the last character
+    EXPECT_THROW(base64::to_bytes(std::string("TR==")), std::runtime_error);
+    EXPECT_THROW(base64::to_bytes(std::string("TWF=")), std::runtime_error);
+}
+
+TEST(Base64, round_trip_all_lengths)
+{
+    for (size_t n = 0; n < 300; n++)
+    {
+        bytes b = random_bytes(n, static_cast<unsigned>(n));
+        bytes encoded = base64::from_bytes(b);
+        ASSERT_EQ(encoded.size(), (n + 2) / 3 * 4);
+        std::list<byte> as_list(b.begin(), b.end());
+        ASSERT_EQ(base64::from_bytes(as_list), encoded);
+        ASSERT_EQ(base64::to_bytes(encoded), b);
+        std::list<byte> encoded_list(encoded.begin(), encoded.end());
+        ASSERT_EQ(base64::to_bytes(encoded_list), b);
+    }
+}
+
+TEST(Base64, invalid_character_at_every_position)
+{
+    bytes encoded = base64::from_bytes(random_bytes(99, 7));
+    for (size_t i = 0; i < encoded.size(); i++)
+    {
+        bytes bad = encoded;
+        bad[i] = '.';
+        ASSERT_THROW(base64::to_bytes(bad), std::runtime_error);
+        bad[i] = '=';
+        ASSERT_THROW(base64::to_bytes(bad), std::runtime_error);
+    }
+}
+
+#if CRYPTO_X86_SIMD
+TEST(Base64, simd_kernels)
+{
+    std::vector<base64::detail::kernel> decoders, encoders;
+    if (cpu::features().ssse3)
+    {
+        decoders.push_back(base64::detail::decode_ssse3);
+        encoders.push_back(base64::detail::encode_ssse3);
+    }
+    if (cpu::features().avx2)
+    {
+        decoders.push_back(base64::detail::decode_avx2);
+        encoders.push_back(base64::detail::encode_avx2);
+    }
+
+    const size_t groups = 333;
+    bytes b = random_bytes(3 * groups, 42);
+    bytes expected(4 * groups);
+    base64::detail::encode_scalar(b.data(), groups, expected.data());
+    for (auto encode : encoders)
+    {
+        bytes out(4 * groups);
+        size_t done = encode(b.data(), groups, out.data());
+        ASSERT_GT(done, 0);
+        ASSERT_TRUE(std::equal(out.begin(), out.begin() + 4 * done, expected.begin()));
+    }
+    for (auto decode : decoders)
+    {
+        bytes out(3 * groups);
+        size_t done = decode(expected.data(), groups, out.data());
+        ASSERT_GT(done, 0);
+        ASSERT_TRUE(std::equal(out.begin(), out.begin() + 3 * done, b.begin()));
+
+        bytes bad = expected;
+        bad[10] = '*';
+        ASSERT_LE(decode(bad.data(), groups, out.data()), 2);
+    }
+}
+#endif
+
+TEST(Hex, output_iterators)
+{
+    bytes b = random_bytes(5000, 5);
+    bytes expected = hex::from_bytes(b);
+    std::list<byte> b_list(b.begin(), b.end());
+
+    // Reuse one buffer for several conversions
+    bytes buffer;
+    buffer.reserve(hex::encoded_size(b.size()));
+    for (size_t n : {size_t(0), size_t(1), size_t(100), b.size()})
+    {
+        buffer.resize(hex::encoded_size(n));
+        auto end = hex::from_bytes(b.begin(), b.begin() + n, buffer.begin());
+        ASSERT_TRUE(end == buffer.end());
+        ASSERT_TRUE(std::equal(buffer.begin(), buffer.end(), expected.begin()));
+    }
+    EXPECT_EQ(buffer.capacity(), hex::encoded_size(b.size()));
+
+    std::string as_string;
+    hex::from_bytes(b_list.begin(), b_list.end(), std::back_inserter(as_string));
+    EXPECT_EQ(as_string, std::string(expected.begin(), expected.end()));
+
+    bytes decoded(hex::decoded_size(expected.size()));
+    byte *end = hex::to_bytes(expected.data(), expected.data() + expected.size(), decoded.data());
+    EXPECT_EQ(end, decoded.data() + decoded.size());
+    EXPECT_EQ(decoded, b);
+
+    std::list<byte> decoded_list;
+    hex::to_bytes(as_string.begin(), as_string.end(), std::back_inserter(decoded_list));
+    EXPECT_TRUE(decoded_list == b_list);
+
+    std::list<char> odd(as_string.begin(), as_string.end());
+    odd.push_back('a');
+    EXPECT_THROW(hex::to_bytes(odd.begin(), odd.end(), decoded.begin()), std::runtime_error);
+}
+
+TEST(Base64, output_iterators)
+{
+    for (size_t n : {0, 1, 2, 3, 3072, 3073, 10000})
+    {
+        bytes b = random_bytes(n, static_cast<unsigned>(n));
+        bytes expected = base64::from_bytes(b);
+        std::list<byte> b_list(b.begin(), b.end());
+
+        bytes encoded(base64::encoded_size(n));
+        EXPECT_TRUE(base64::from_bytes(b.begin(), b.end(), encoded.begin()) == encoded.end());
+        EXPECT_EQ(encoded, expected);
+
+        std::list<byte> encoded_list;
+        base64::from_bytes(b_list.begin(), b_list.end(), std::back_inserter(encoded_list));
+        EXPECT_TRUE(std::equal(encoded_list.begin(), encoded_list.end(), expected.begin()));
+
+        EXPECT_EQ(base64::decoded_size(expected), n);
+        EXPECT_EQ(base64::decoded_size(encoded_list.begin(), encoded_list.end()), n);
+        EXPECT_LE(n, base64::max_decoded_size(expected.size()));
+
+        bytes decoded(base64::decoded_size(expected));
+        base64::to_bytes(expected.begin(), expected.end(), decoded.begin());
+        EXPECT_EQ(decoded, b);
+
+        bytes decoded_from_list;
+        base64::to_bytes(encoded_list.begin(), encoded_list.end(),
+                         std::back_inserter(decoded_from_list));
+        EXPECT_EQ(decoded_from_list, b);
+    }
+
+    // Padding in the middle of a long input that is converted in blocks
+    std::string s = std::string(3068, 'A') + "AA==" + "AAAA";
+    std::list<char> padded(s.begin(), s.end());
+    bytes out;
+    EXPECT_THROW(base64::to_bytes(padded.begin(), padded.end(), std::back_inserter(out)),
+                 std::runtime_error);
+    EXPECT_THROW(base64::decoded_size(std::string("AAA")), std::runtime_error);
+}
+
+// Feeds the input to the codec in chunks of chunk_size bytes
+template <typename Codec>
+static bytes run_chunked(Codec &codec, const bytes &input, size_t chunk_size)
+{
+    bytes output;
+    bytes buffer(codec.max_output_size(chunk_size));
+    for (size_t i = 0; i < input.size(); i += chunk_size)
+    {
+        size_t n = std::min(chunk_size, input.size() - i);
+        size_t written = codec.update(input.data() + i, n, buffer.data());
+        EXPECT_LE(written, buffer.size());
+        output.insert(output.end(), buffer.begin(), buffer.begin() + written);
+    }
+    size_t written = codec.finish(buffer.data());
+    output.insert(output.end(), buffer.begin(), buffer.begin() + written);
+    return output;
+}
+
+// Breaks the text into lines of line_length characters
+static bytes wrap(const bytes &text, size_t line_length, const std::string &newline)
+{
+    bytes wrapped;
+    for (size_t i = 0; i < text.size(); i += line_length)
+    {
+        wrapped.insert(wrapped.end(), text.begin() + i,
+                       text.begin() + std::min(text.size(), i + line_length));
+        wrapped.insert(wrapped.end(), newline.begin(), newline.end());
+    }
+    return wrapped;
+}
+
+TEST(Stream, hex_chunked)
+{
+    bytes b = random_bytes(1000, 3);
+    bytes encoded = hex::from_bytes(b);
+    bytes wrapped = wrap(encoded, 61, "\r\n");
+    for (size_t chunk : {1, 2, 3, 7, 64, 1000, 5000})
+    {
+        hex::Encoder encoder;
+        ASSERT_EQ(run_chunked(encoder, b, chunk), encoded);
+        hex::Decoder decoder;
+        ASSERT_EQ(run_chunked(decoder, wrapped, chunk), b);
+    }
+}
+
+TEST(Stream, hex_errors)
+{
+    hex::Decoder decoder;
+    bytes out(16);
+    std::string s = "abc";
+    EXPECT_EQ(decoder.update(reinterpret_cast<const byte *>(s.data()), s.size(), out.data()), 1);
+    EXPECT_THROW(decoder.finish(out.data()), std::runtime_error);
+
+    hex::Decoder bad;
+    s = "ab\nxy";
+    EXPECT_THROW(bad.update(reinterpret_cast<const byte *>(s.data()), s.size(), out.data()),
+                 std::runtime_error);
+}
+
+TEST(Stream, base64_chunked)
+{
+    for (size_t n : {0, 1, 2, 3, 100, 1000, 1001, 1002})
+    {
+        bytes b = random_bytes(n, static_cast<unsigned>(n));
+        bytes encoded = base64::from_bytes(b);
+        bytes mime = encoded.empty() ? bytes() : wrap(encoded, 76, "\n");
+        for (size_t chunk : {1, 2, 3, 5, 64, 1000, 5000})
+        {
+            base64::Encoder encoder;
+            ASSERT_EQ(run_chunked(encoder, b, chunk), encoded);
+            base64::Encoder mime_encoder(76);
+            ASSERT_EQ(run_chunked(mime_encoder, b, chunk), mime);
+            base64::Decoder decoder;
+            ASSERT_EQ(run_chunked(decoder, mime, chunk), b);
+        }
+    }
+
+    // Empty updates, with a null pointer
+    base64::Encoder encoder;
+    EXPECT_EQ(encoder.update(nullptr, 0, nullptr), 0u);
+}
+
+TEST(Stream, base64_errors)
+{
+    auto decode = [](const std::string &s) {
+        base64::Decoder decoder;
+        bytes input(s.begin(), s.end());
+        return run_chunked(decoder, input, 1);
+    };
+    EXPECT_EQ(decode("TQ\n==\n"), bytes({'M'}));
+    EXPECT_THROW(decode("TQ==TWFu"), std::runtime_error);
+    EXPECT_THROW(decode("TQ==\nTWFu"), std::runtime_error);
+    EXPECT_THROW(decode("TWF"), std::runtime_error);
+    EXPECT_THROW(decode("TW.u"), std::runtime_error);
+    EXPECT_THROW(base64::Encoder(10), std::logic_error);
+}
+
+TEST(Stream, iostream_and_fd)
+{
+    bytes b = random_bytes(200000, 11);
+    std::string raw(b.begin(), b.end());
+
+    std::istringstream raw_in(raw);
+    std::ostringstream encoded_out;
+    base64::encode_stream(raw_in, encoded_out, 76);
+    std::istringstream encoded_in(encoded_out.str());
+    std::ostringstream decoded_out;
+    EXPECT_EQ(base64::decode_stream(encoded_in, decoded_out), b.size());
+    EXPECT_EQ(decoded_out.str(), raw);
+
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    ASSERT_TRUE(in != nullptr && out != nullptr);
+    bytes encoded = hex::from_bytes(b);
+    ASSERT_EQ(fwrite(encoded.data(), 1, encoded.size(), in), encoded.size());
+    fflush(in);
+    rewind(in);
+    EXPECT_EQ(hex::decode_stream(fileno(in), fileno(out)), b.size());
+    rewind(out);
+    bytes decoded(b.size());
+    ASSERT_EQ(fread(decoded.data(), 1, decoded.size(), out), decoded.size());
+    EXPECT_EQ(decoded, b);
+    fclose(in);
+    fclose(out);
+}
+
+TEST(FixedXOR, kernels)
+{
+    for (size_t n : {0, 1, 7, 8, 31, 32, 63, 64, 65, 200, 1000})
+    {
+        bytes a = random_bytes(n, static_cast<unsigned>(n));
+        bytes b = random_bytes(n, static_cast<unsigned>(n + 1));
+        bytes expected(n);
+        for (size_t i = 0; i < n; i++)
+            expected[i] = a[i] ^ b[i];
+
+        EXPECT_EQ(fixed_XOR(a, b), expected);
+        const std::string s(b.begin(), b.end());
+        EXPECT_EQ(fixed_XOR(a, s), expected);
+
+        bytes out(n);
+        fixed_XOR(a, b, out);
+        EXPECT_EQ(out, expected);
+
+        bytes in_place = a;
+        fixed_XOR_inplace(in_place, b);
+        EXPECT_EQ(in_place, expected);
+
+        // Unaligned in place XOR through the kernel directly
+        if (n > 1)
+        {
+            bytes c = a;
+            ::detail::xor_bytes(c.data() + 1, b.data() + 1, n - 1, c.data() + 1);
+            EXPECT_TRUE(std::equal(c.begin() + 1, c.end(), expected.begin() + 1));
+        }
+    }
+    bytes a(3), b(4);
+    EXPECT_THROW(fixed_XOR(a, b), std::logic_error);
+    EXPECT_THROW(fixed_XOR_inplace(a, b), std::logic_error);
+}
+
+TEST(FixedXOR, stream)
+{
+    bytes a = random_bytes(3 * ::detail::STREAM_CHUNK_SIZE + 5, 31);
+    bytes b = random_bytes(a.size(), 32);
+    std::istringstream sa(std::string(a.begin(), a.end()));
+    std::istringstream sb(std::string(b.begin(), b.end()));
+    std::ostringstream out;
+    EXPECT_EQ(fixed_XOR_stream(sa, sb, out), a.size());
+    bytes expected = fixed_XOR(a, b);
+    EXPECT_EQ(out.str(), std::string(expected.begin(), expected.end()));
+
+    std::istringstream longer(std::string(a.begin(), a.end()) + "x");
+    std::istringstream shorter(std::string(b.begin(), b.end()));
+    std::ostringstream discard;
+    EXPECT_THROW(fixed_XOR_stream(shorter, longer, discard), std::runtime_error);
+}
+
+TEST(RepeatingKeyXOR, matches_simple_loop)
+{
+    bytes text = random_bytes(20000, 41);
+    for (size_t key_size : {1, 3, 7, 64, 100, 4097, 70000})
+    {
+        bytes key = random_bytes(key_size, static_cast<unsigned>(key_size));
+        bytes expected(text.size());
+        for (size_t i = 0; i < text.size(); i++)
+            expected[i] = text[i] ^ key[i % key_size];
+        ASSERT_EQ(repeating_key_XOR(text, key), expected);
+
+        // Any split into chunks continues at the right key phase, in place
+        for (size_t chunk : {1, 5, 63, 1000})
+        {
+            RepeatingKeyXOR engine(key);
+            bytes data = text;
+            for (size_t i = 0; i < data.size(); i += chunk)
+            {
+                size_t n = std::min(chunk, data.size() - i);
+                engine.update(data.data() + i, n, data.data() + i);
+            }
+            ASSERT_EQ(data, expected);
+            ASSERT_EQ(engine.phase(), text.size() % key_size);
+        }
+
+        RepeatingKeyXOR engine(key);
+        engine.seek(3);
+        bytes tail(text.begin() + 3, text.end());
+        engine.update(tail.data(), tail.size(), tail.data());
+        ASSERT_TRUE(std::equal(tail.begin(), tail.end(), expected.begin() + 3));
+    }
+    std::list<char> list_key = {'I', 'C', 'E'};
+    EXPECT_EQ(repeating_key_XOR(std::string("abc"), list_key),
+              fixed_XOR(std::string("abc"), std::string("ICE")));
+    EXPECT_THROW(RepeatingKeyXOR(std::string()), std::logic_error);
+}
+
+TEST(RepeatingKeyXOR, stream)
+{
+    bytes text = random_bytes(200000, 42);
+    std::istringstream in(std::string(text.begin(), text.end()));
+    std::ostringstream out;
+    EXPECT_EQ(repeating_key_XOR_stream(in, out, std::string("secret key")), text.size());
+    bytes expected = repeating_key_XOR(text, std::string("secret key"));
+    EXPECT_EQ(out.str(), std::string(expected.begin(), expected.end()));
+}
+
+// The tables are built at compile time
+TEST(Hamming, kernels)
+{
+    bytes a = random_bytes(600, 7), b = random_bytes(600, 8);
+    std::vector<hamming::detail::distance_kernel> kernels = {hamming::detail::distance_scalar};
+#if CRYPTO_X86_SIMD
+    if (cpu::features().popcnt)
+        kernels.push_back(hamming::detail::distance_popcnt);
+    if (cpu::features().avx2)
+        kernels.push_back(hamming::detail::distance_avx2);
+    if (cpu::features().avx512vpopcntdq)
+        kernels.push_back(hamming::detail::distance_avx512);
+#endif
+    // Every length and misalignment, so that each kernel leaves tails of every size
+    for (size_t offset : {0, 1, 7})
+    {
+        for (size_t n = 0; n + offset <= 300; n++)
+        {
+            uint64_t expected = 0;
+            for (size_t i = 0; i < n; i++)
+                expected += static_cast<uint64_t>(__builtin_popcount(a[offset + i] ^ b[i]));
+            for (auto kernel : kernels)
+            {
+                uint64_t bits = 0;
+                size_t done = kernel(a.data() + offset, b.data(), n, bits);
+                hamming::detail::distance_scalar(a.data() + offset + done, b.data() + done,
+                                                 n - done, bits);
+                ASSERT_EQ(bits, expected) << n << " " << offset;
+            }
+            ASSERT_EQ(hamming::distance(a.data() + offset, b.data(), n), expected);
+        }
+    }
+}
+
+TEST(Hamming, iterators)
+{
+    std::string s1 = "this is a test", s2 = "wokka wokka!!!";
+    std::list<char> l1(s1.begin(), s1.end());
+    bytes b2(s2.begin(), s2.end());
+    EXPECT_EQ(hamming::distance(s1, s2), 37u);
+    EXPECT_EQ(hamming::distance(l1.begin(), l1.end(), b2.begin(), b2.end()), 37u);
+    EXPECT_EQ(hamming::distance(bytes(), std::string()), 0u);
+    EXPECT_THROW(hamming::distance(s1, s2.substr(1)), std::logic_error);
+    EXPECT_THROW(hamming::distance(l1.begin(), l1.end(), b2.begin() + 1, b2.end()),
+                 std::logic_error);
+}
+
+// Random sentences of common words, enough like english for the statistical tests
+static std::string english_text(size_t n, unsigned seed)
+{
+    static const char *words[] = {"the", "of",   "and",  "to",    "in",    "is",   "you",
+                                  "that", "it",  "he",   "was",   "for",   "on",   "are",
+                                  "as",  "with", "his",  "they",  "at",    "be",   "this",
+                                  "have", "from", "word", "music", "party", "noise", "bring"};
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<size_t> pick(0, sizeof(words) / sizeof(words[0]) - 1);
+    std::string text;
+    while (text.size() < n)
+    {
+        text += words[pick(generator)];
+        text += pick(generator) % 9 == 0 ? ". " : " ";
+    }
+    text.resize(n);
+    return text;
+}
+
+TEST(Hamming, distance_matrix)
+{
+    // Groups of three records encrypted with the same key, among random ones
+    const size_t count = 700, length = 128;
+    std::vector<bytes> records;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i % 100 < 3)
+        {
+            bytes key = random_bytes(length, static_cast<unsigned>(i / 100));
+            std::string text = english_text(length + 10, static_cast<unsigned>(i));
+            records.push_back(repeating_key_XOR(text, key));
+        }
+        else
+            records.push_back(random_bytes(length + i % 5, static_cast<unsigned>(i + 1000)));
+    }
+    bytes arena = hamming::pack_prefixes(records, length);
+    ASSERT_EQ(arena.size(), count * length);
+
+    ThreadPool pool(3);
+    auto matrix = hamming::distance_matrix(arena.data(), count, length, pool);
+    ASSERT_EQ(matrix.size(), count * count);
+    std::vector<hamming::Pair> expected;
+    // About 2.6 differing bits per byte between two texts, 4 between random bytes
+    const uint64_t threshold = 420;
+    for (size_t i = 0; i < count; i++)
+    {
+        EXPECT_EQ(matrix[i * count + i], 0);
+        for (size_t j = i + 1; j < count; j++)
+        {
+            uint64_t d = 0;
+            for (size_t k = 0; k < length; k++)
+                d += static_cast<uint64_t>(__builtin_popcount(records[i][k] ^ records[j][k]));
+            ASSERT_EQ(matrix[i * count + j], d) << i << " " << j;
+            ASSERT_EQ(matrix[j * count + i], d);
+            if (d <= threshold)
+                expected.push_back({i, j, d});
+        }
+    }
+
+    auto pairs = hamming::close_pairs(arena.data(), count, length, threshold, pool);
+    ASSERT_EQ(pairs.size(), expected.size());
+    for (size_t p = 0; p < pairs.size(); p++)
+    {
+        EXPECT_EQ(pairs[p].a, expected[p].a);
+        EXPECT_EQ(pairs[p].b, expected[p].b);
+        EXPECT_EQ(pairs[p].distance, expected[p].distance);
+        EXPECT_EQ(pairs[p].a / 100, pairs[p].b / 100);
+    }
+    // The three records of every group
+    EXPECT_EQ(pairs.size(), 7 * 3);
+
+    EXPECT_TRUE(hamming::close_pairs(arena.data(), 0, length, threshold, pool).empty());
+    EXPECT_THROW(hamming::pack_prefixes(records, length + 11), std::logic_error);
+}
+
+TEST(KeySize, estimate)
+{
+    std::string key = "Thirteen key!";
+    bytes ciphertext = repeating_key_XOR(english_text(3000, 1), key);
+    ThreadPool pool(3), single(1);
+    auto estimates = key_size::estimate(ciphertext, 2, 40, 3, 0, pool);
+    ASSERT_EQ(estimates.size(), 3);
+    EXPECT_EQ(estimates[0].key_size, key.size());
+    EXPECT_EQ(estimates[0].pairs, 3000 / key.size() - 1);
+    EXPECT_LE(estimates[0].distance, estimates[1].distance);
+    EXPECT_LE(estimates[1].distance, estimates[2].distance);
+
+    auto serial = key_size::estimate(ciphertext, 2, 40, 3, 0, single);
+    for (size_t i = 0; i < estimates.size(); i++)
+    {
+        EXPECT_EQ(serial[i].key_size, estimates[i].key_size);
+        EXPECT_EQ(serial[i].distance, estimates[i].distance);
+    }
+
+    // A sample of the pairs is enough, and as many pairs as there are is the same as all of them
+    EXPECT_EQ(key_size::estimate(ciphertext, 2, 40, 1, 20, pool)[0].key_size, key.size());
+    auto all = key_size::normalized_distance(ciphertext.data(), ciphertext.size(), 13);
+    auto sampled = key_size::normalized_distance(ciphertext.data(), ciphertext.size(), 13, 1000);
+    EXPECT_EQ(all.distance, sampled.distance);
+    uint64_t bits = 0;
+    for (size_t i = 0; i + 1 < ciphertext.size() / 13; i++)
+        bits += hamming::distance(&ciphertext[i * 13], &ciphertext[(i + 1) * 13], 13);
+    EXPECT_EQ(all.distance, static_cast<double>(bits) / static_cast<double>(all.pairs * 13));
+
+    // Key sizes without two blocks cannot be estimated
+    EXPECT_EQ(key_size::normalized_distance(ciphertext.data(), 25, 13).pairs, 0);
+    EXPECT_EQ(key_size::estimate(ciphertext, 20, 10, 3, 0, pool).size(), 0);
+    EXPECT_EQ(key_size::estimate(bytes(), 1, 40, 100, 0, pool).size(), 40);
+}
+
+TEST(Columns, transpose_and_histograms)
+{
+    for (size_t n : {0, 1, 39, 40, 41, 1000, 4096 * 3 + 17})
+    {
+        bytes text = random_bytes(n, static_cast<unsigned>(n));
+        for (size_t key_size : {1, 2, 7, 29, 40, 64})
+        {
+            bytes expected;
+            std::vector<single_byte_xor::Histogram> expected_histograms(key_size);
+            for (size_t c = 0; c < key_size; c++)
+            {
+                single_byte_xor::Histogram h{};
+                for (size_t i = c; i < n; i += key_size)
+                {
+                    expected.push_back(text[i]);
+                    h[text[i]]++;
+                }
+                expected_histograms[c] = h;
+            }
+            bytes transposed = columns::transpose(text, key_size);
+            ASSERT_EQ(transposed, expected) << n << " " << key_size;
+            for (size_t c = 0; c < key_size; c++)
+            {
+                size_t offset = columns::column_offset(n, key_size, c);
+                size_t length = columns::column_length(n, key_size, c);
+                ASSERT_LE(offset + length, n);
+                if (length > 0)
+                {
+                    EXPECT_EQ(transposed[offset], text[c]);
+                }
+            }
+            EXPECT_EQ(columns::histograms(text, key_size), expected_histograms);
+        }
+    }
+    EXPECT_THROW(columns::transpose(bytes(4), 0), std::logic_error);
+    EXPECT_THROW(columns::histograms(bytes(4), 0), std::logic_error);
+}
+
+TEST(Period, kernels)
+{
+    bytes a = random_bytes(600, 9), b = a;
+    // About one byte in three differs
+    for (size_t i = 0; i < b.size(); i += 1 + i % 5)
+        b[i] ^= static_cast<byte>(1 << (i % 8));
+    std::vector<period::detail::match_kernel> kernels = {period::detail::matches_scalar};
+#if CRYPTO_X86_SIMD
+    if (cpu::features().avx2)
+        kernels.push_back(period::detail::matches_avx2);
+    if (cpu::features().avx512bw && cpu::features().popcnt)
+        kernels.push_back(period::detail::matches_avx512);
+#endif
+    for (size_t offset : {0, 3})
+    {
+        for (size_t n = 0; n + offset <= 600; n++)
+        {
+            uint64_t expected = 0;
+            for (size_t i = 0; i < n; i++)
+                expected += a[offset + i] == b[offset + i];
+            for (auto kernel : kernels)
+            {
+                uint64_t matches = 0;
+                size_t done = kernel(a.data() + offset, b.data() + offset, n, matches);
+                period::detail::matches_scalar(a.data() + offset + done,
+                                               b.data() + offset + done, n - done, matches);
+                ASSERT_EQ(matches, expected) << n << " " << offset;
+            }
+        }
+    }
+    // Long enough for the AVX2 byte counters to be flushed several times
+    bytes zeros(100000), ones(100000, 0);
+    EXPECT_EQ(period::count_matches(zeros.data(), ones.data(), zeros.size()), 100000);
+}
+
+TEST(Period, spectrum)
+{
+    bytes key = random_bytes(700, 10);
+    bytes ciphertext = repeating_key_XOR(english_text(60000, 3), key);
+    ThreadPool pool(3);
+    auto rates = period::spectrum(ciphertext, 1500, 0, pool);
+    ASSERT_EQ(rates.size(), 1501);
+    EXPECT_EQ(rates[0], 1);
+    EXPECT_EQ(period::detect_period(rates), 700);
+    EXPECT_GT(rates[1400], 4 * rates[1399]);
+
+    // Same counts as comparing the shifted ciphertext directly
+    for (size_t s : {1, 699, 700, 1500})
+    {
+        uint64_t matches = 0;
+        for (size_t i = 0; i + s < ciphertext.size(); i++)
+            matches += ciphertext[i] == ciphertext[i + s];
+        EXPECT_EQ(rates[s],
+                  static_cast<double>(matches) / static_cast<double>(ciphertext.size() - s))
+            << s;
+    }
+
+    auto sampled = period::spectrum(ciphertext, 1500, 30000, pool);
+    EXPECT_EQ(period::detect_period(sampled), 700);
+
+    auto short_text = period::spectrum(bytes(5, 'a'), 10, 0, pool);
+    EXPECT_EQ(short_text[4], 1);
+    EXPECT_EQ(short_text[5], 0);
+    EXPECT_EQ(period::detect_period(period::spectrum(bytes(), 10, 0, pool)), 0);
+    EXPECT_EQ(period::detect_period(std::vector<double>(1, 1)), 0);
+}
+
+static_assert(score::TABLE<score::English>.v[' '] == 27, "space is the most frequent");
+static_assert(score::TABLE<score::English>.v['Z'] == 1, "z is the least frequent letter");
+static_assert(score::TABLE<score::English>.v['!'] == 0, "special characters score 0");
+
+TEST(Score, matches_runtime_table)
+{
+    // The table the challenges used to build at startup, plus the special character correction
+    const std::string frequency_dist = " etaoinshrdlcumwfgypbvkjxqz";
+    int expected[256];
+    for (int i = 0; i < 256; i++)
+    {
+        expected[i] = isalnum(i) || isspace(i) ? 1 : -1;
+        bool special_or_digit = ('0' <= i && i <= '9') || (33 <= i && i <= 64) ||
+                                (91 <= i && i <= 96) || (123 <= i && i <= 126);
+        expected[i] += special_or_digit;
+    }
+    int i = static_cast<int>(frequency_dist.size());
+    for (const auto &ch : frequency_dist)
+    {
+        expected[static_cast<byte>(ch)] = i;
+        expected[static_cast<byte>(toupper(ch))] = i;
+        --i;
+    }
+    for (int c = 0; c < 256; c++)
+        ASSERT_EQ(score::TABLE<score::English>.v[c], expected[c]) << c;
+
+    EXPECT_EQ(score::score(std::string("Ee!")), 26 + 26 + 0);
+    EXPECT_EQ(score::score<score::German>(std::string("Ee!")), 26 + 26 + 0);
+    EXPECT_EQ(score::score<score::German>(std::string("n")), 25);
+    EXPECT_EQ(score::score(std::string("n")), 21);
+    EXPECT_EQ(score::score(bytes()), 0);
+}
+
+TEST(SingleByteXOR, matches_brute_force)
+{
+    int weights[256];
+    std::mt19937 rng(51);
+    for (int &w : weights)
+        w = static_cast<int>(rng() % 41) - 20;
+
+    for (size_t n : {0, 1, 30, 300, 100000})
+    {
+        bytes text = random_bytes(n, static_cast<unsigned>(n));
+        int64_t expected[256];
+        for (int k = 0; k < 256; k++)
+        {
+            expected[k] = 0;
+            for (byte c : text)
+                expected[k] += weights[c ^ k];
+        }
+        auto histogram = single_byte_xor::histogram(text.data(), n);
+        auto scores = single_byte_xor::score_keys(histogram, weights);
+        for (int k = 0; k < 256; k++)
+            ASSERT_EQ(scores[k], expected[k]);
+
+        auto top = single_byte_xor::top_keys(text, weights, 5);
+        ASSERT_EQ(top.size(), 5);
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            ASSERT_EQ(top[i].score, expected[top[i].key]);
+            if (i > 0)
+            {
+                ASSERT_TRUE(top[i - 1].score > top[i].score ||
+                            (top[i - 1].score == top[i].score && top[i - 1].key < top[i].key));
+            }
+        }
+        ASSERT_EQ(*std::max_element(expected, expected + 256), top[0].score);
+    }
+
+    // Both versions of the transform, applying it twice multiplies by 256
+    int64_t x[256], y[256];
+    for (int i = 0; i < 256; i++)
+        x[i] = y[i] = weights[i];
+    single_byte_xor::detail::walsh_hadamard_scalar(x);
+    single_byte_xor::detail::walsh_hadamard(y);
+    EXPECT_TRUE(std::equal(x, x + 256, y));
+    single_byte_xor::detail::walsh_hadamard(y);
+    for (int i = 0; i < 256; i++)
+        ASSERT_EQ(y[i], 256 * weights[i]);
+}
+
+TEST(SingleByteXOR, solve)
+{
+    // Lower case letters are good, everything else is bad
+    int weights[256];
+    for (int c = 0; c < 256; c++)
+        weights[c] = ('a' <= c && c <= 'z') || c == ' ' ? 1 : -1;
+    std::string text = "the quick brown fox jumps over the lazy dog";
+    bytes ciphertext = repeating_key_XOR(text, std::string("\x5a"));
+    auto result = single_byte_xor::solve(ciphertext, weights);
+    EXPECT_EQ(result.key, 0x5a);
+    EXPECT_EQ(result.score, static_cast<int64_t>(text.size()));
+    EXPECT_EQ(result.plaintext, bytes(text.begin(), text.end()));
+    EXPECT_EQ(single_byte_xor::top_keys(ciphertext, weights, 1000).size(), 256);
+}
+
+TEST(SingleByteXOR, scan_hex_lines)
+{
+    std::string english = "Now that the party is jumping";
+    bytes encrypted = hex::from_bytes(repeating_key_XOR(english, std::string("5")));
+    std::string text;
+    const size_t lines = 2000, target = 1234;
+    for (size_t i = 0; i < lines; i++)
+    {
+        if (i == target)
+            text += std::string(encrypted.begin(), encrypted.end());
+        else if (i == 10)
+            text += "not hex";
+        else if (i % 100 != 0)
+        {
+            bytes line = hex::from_bytes(random_bytes(30, static_cast<unsigned>(i)));
+            text.append(line.begin(), line.end());
+        }
+        // Every hundredth line is empty
+        text += i % 2 == 0 ? "\n" : "\r\n";
+    }
+    const auto *data = reinterpret_cast<const byte *>(text.data());
+    ThreadPool pool(3);
+    for (size_t chunk_size : {1, 100, 1 << 20})
+    {
+        auto result = single_byte_xor::scan_hex_lines(data, text.size(),
+                                                      score::TABLE<score::English>.v, 3, pool,
+                                                      chunk_size);
+        ASSERT_EQ(result.best.size(), 3);
+        EXPECT_EQ(result.best[0].line, target);
+        EXPECT_EQ(result.best[0].key, '5');
+        EXPECT_EQ(result.best[0].plaintext, bytes(english.begin(), english.end()));
+        EXPECT_EQ(result.best[0].score, score::score(english));
+        EXPECT_EQ(text.substr(result.best[0].offset, result.best[0].length),
+                  std::string(encrypted.begin(), encrypted.end()));
+        EXPECT_GE(result.best[0].score, result.best[1].score);
+        EXPECT_GE(result.best[1].score, result.best[2].score);
+        EXPECT_EQ(result.stats.lines, lines);
+        EXPECT_EQ(result.stats.invalid_lines, 1);
+        EXPECT_EQ(result.stats.bytes, text.size());
+    }
+    auto none =
+        single_byte_xor::scan_hex_lines(nullptr, 0, score::TABLE<score::English>.v, 3, pool);
+    EXPECT_TRUE(none.best.empty());
+    EXPECT_EQ(none.stats.lines, 0);
+}
+
+TEST(SingleByteXOR, batch)
+{
+    const auto &weights = score::TABLE<score::English>.v;
+    single_byte_xor::Batch batch;
+    std::vector<bytes> records;
+    // More records than one task scores, of all lengths including empty ones
+    for (size_t i = 0; i < 10000; i++)
+    {
+        bytes record = random_bytes(i % 61, static_cast<unsigned>(i));
+        if (i % 3 == 0)
+            record = repeating_key_XOR(std::string("Cooking MC's like a pound of bacon").substr(
+                                           0, i % 35),
+                                       bytes(1, static_cast<byte>(i)));
+        records.push_back(record);
+        batch.add(record);
+    }
+    batch.add(bytes(5, 'x'));
+    batch.pop_back();
+    ASSERT_EQ(batch.size(), records.size());
+
+    ThreadPool pool(3);
+    auto result = single_byte_xor::score_batch(batch, weights, pool);
+    ASSERT_EQ(result.keys.size(), records.size());
+    ASSERT_EQ(result.scores.size(), records.size());
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        ASSERT_EQ(bytes(batch.data(i), batch.data(i) + batch.length(i)), records[i]);
+        auto expected = single_byte_xor::solve(records[i], weights);
+        EXPECT_EQ(result.keys[i], expected.key) << i;
+        EXPECT_EQ(result.scores[i], expected.score) << i;
+    }
+
+    batch.clear();
+    EXPECT_TRUE(batch.empty());
+    EXPECT_TRUE(single_byte_xor::score_batch(batch, weights, pool).keys.empty());
+    EXPECT_THROW(batch.pop_back(), std::logic_error);
+}
+
+TEST(RepeatingKeyXOR, crack)
+{
+    std::string text = english_text(5000, 2), key = "Vanilla ice";
+    bytes ciphertext = repeating_key_XOR(text, key);
+    const auto &weights = score::TABLE<score::English>.v;
+    ThreadPool pool(3);
+    repeating_key_xor::Options options;
+    options.key_sizes = 3;
+    auto result = repeating_key_xor::crack(ciphertext, weights, options, pool);
+    EXPECT_TRUE(result.complete);
+    ASSERT_EQ(result.candidates.size(), 3);
+    const auto &best = result.candidates.front();
+    EXPECT_EQ(best.key, bytes(key.begin(), key.end()));
+    EXPECT_EQ(best.key_size, key.size());
+    EXPECT_EQ(best.plaintext, bytes(text.begin(), text.end()));
+    EXPECT_EQ(best.score, score::score(text));
+    for (const auto &candidate : result.candidates)
+    {
+        EXPECT_EQ(candidate.key.size(), candidate.key_size);
+        EXPECT_EQ(candidate.score, score::score(candidate.plaintext));
+        EXPECT_LE(candidate.score, best.score);
+    }
+
+    std::atomic<bool> cancel(true);
+    options.cancel = &cancel;
+    auto cancelled = repeating_key_xor::crack(ciphertext, weights, options, pool);
+    EXPECT_FALSE(cancelled.complete);
+    EXPECT_TRUE(cancelled.candidates.empty());
+
+    EXPECT_TRUE(repeating_key_xor::crack(bytes(), weights).candidates.empty());
+}
+
+TEST(RepeatingKeyXOR, streaming_cracker)
+{
+    std::string text = english_text(200000, 4), key = "Play that funky music";
+    bytes ciphertext = repeating_key_XOR(text, key);
+    const auto &weights = score::TABLE<score::English>.v;
+
+    // Chunks of every size, so that rows and sample blocks are split everywhere
+    repeating_key_xor::StreamingCracker cracker(2, 40);
+    std::mt19937 generator(5);
+    for (size_t i = 0; i < ciphertext.size();)
+    {
+        size_t n = std::min(ciphertext.size() - i, generator() % 3 == 0 ? 1 : generator() % 5000);
+        cracker.update(&ciphertext[i], n);
+        i += n;
+    }
+    EXPECT_EQ(cracker.size(), ciphertext.size());
+    EXPECT_EQ(cracker.sampled(), ciphertext.size());
+    auto candidates = cracker.candidates(weights);
+    ASSERT_EQ(candidates.size(), 2);
+    EXPECT_EQ(candidates[0].key, bytes(key.begin(), key.end()));
+    EXPECT_EQ(candidates[0].score, score::score(text));
+    EXPECT_TRUE(candidates[0].plaintext.empty());
+
+    // The statistics are those of the whole ciphertext
+    auto sizes = cracker.key_sizes(39);
+    for (const auto &estimate : sizes)
+    {
+        size_t k = estimate.key_size;
+        EXPECT_EQ(estimate.pairs, ciphertext.size() - k);
+        uint64_t bits = hamming::distance(ciphertext.data(), ciphertext.data() + k,
+                                          ciphertext.size() - k);
+        EXPECT_EQ(estimate.distance,
+                  static_cast<double>(bits) / static_cast<double>(ciphertext.size() - k));
+    }
+    EXPECT_EQ(sizes.front().key_size, key.size());
+
+    repeating_key_xor::StreamingCracker sampled(2, 40, 3, 1);
+    sampled.update(ciphertext.data(), ciphertext.size());
+    EXPECT_LT(sampled.sampled(), ciphertext.size() / 2);
+    candidates = sampled.candidates(weights);
+    ASSERT_EQ(candidates.size(), 1);
+    EXPECT_EQ(candidates[0].key, bytes(key.begin(), key.end()));
+
+    // An input shorter than a block is solved from the block that is still held
+    repeating_key_xor::StreamingCracker short_input(2, 40);
+    short_input.update(ciphertext.data(), 5000);
+    short_input.update(ciphertext.data() + 5000, 5000);
+    candidates = short_input.candidates(weights);
+    ASSERT_EQ(candidates.size(), 2);
+    EXPECT_EQ(candidates[0].key, bytes(key.begin(), key.end()));
+    EXPECT_EQ(candidates[0].score, score::score(text.substr(0, 10000)));
+
+    EXPECT_TRUE(repeating_key_xor::StreamingCracker(2, 40).candidates(weights).empty());
+    EXPECT_THROW(repeating_key_xor::StreamingCracker(5, 4), std::logic_error);
+    EXPECT_THROW(repeating_key_xor::StreamingCracker(2, 4, 0), std::logic_error);
+}
+
+// Runs a bulk operation into a vector, with tiny chunks so that the input is split many times
+static bytes run_bulk(bulk::Operation op, const bytes &input, size_t chunk_size,
+                      size_t line_length = 0)
+{
+    static ThreadPool pool(3);
+    bulk::Options options;
+    options.chunk_size = chunk_size;
+    options.line_length = line_length;
+    bytes output;
+    auto allocate = [&output](size_t size) {
+        output.resize(size);
+        return output.data();
+    };
+    size_t size = bulk::transcode(op, input.data(), input.size(), allocate, pool, options);
+    EXPECT_EQ(size, output.size());
+    return output;
+}
+
+TEST(Bulk, hex)
+{
+    bytes b = random_bytes(5000, 21);
+    bytes encoded = hex::from_bytes(b);
+    // Odd line lengths make chunks end in the middle of a byte
+    for (size_t line_length : {2, 61, 128})
+    {
+        bytes wrapped = wrap(encoded, line_length, "\r\n");
+        for (size_t chunk : {1, 7, 100, 4096, 1 << 20})
+        {
+            ASSERT_EQ(run_bulk(bulk::Operation::hex_encode, b, chunk), encoded);
+            ASSERT_EQ(run_bulk(bulk::Operation::hex_decode, wrapped, chunk), b);
+        }
+    }
+    EXPECT_EQ(run_bulk(bulk::Operation::hex_decode, bytes(), 10), bytes());
+    bytes odd = wrap(hex::from_bytes(random_bytes(9, 1)), 7, "\n");
+    odd.pop_back();
+    odd.pop_back();
+    EXPECT_THROW(run_bulk(bulk::Operation::hex_decode, odd, 4), std::runtime_error);
+    bytes invalid = wrap(encoded, 61, "\n");
+    invalid[3000] = 'x';
+    EXPECT_THROW(run_bulk(bulk::Operation::hex_decode, invalid, 100), std::runtime_error);
+}
+
+TEST(Bulk, base64)
+{
+    for (size_t n : {0, 1, 2, 3, 1000, 1001, 1002})
+    {
+        bytes b = random_bytes(n, static_cast<unsigned>(n));
+        bytes encoded = base64::from_bytes(b);
+        bytes mime = encoded.empty() ? bytes() : wrap(encoded, 76, "\n");
+        for (size_t chunk : {1, 5, 100, 1 << 20})
+        {
+            ASSERT_EQ(run_bulk(bulk::Operation::base64_encode, b, chunk), encoded);
+            ASSERT_EQ(run_bulk(bulk::Operation::base64_encode, b, chunk, 76), mime);
+            ASSERT_EQ(run_bulk(bulk::Operation::base64_decode, mime, chunk), b);
+            ASSERT_EQ(run_bulk(bulk::Operation::base64_decode, wrap(encoded, 13, " \n"), chunk), b);
+        }
+    }
+    auto decode = [](const std::string &s) {
+        return run_bulk(bulk::Operation::base64_decode, bytes(s.begin(), s.end()), 4);
+    };
+    EXPECT_EQ(decode("TQ\n==\n\n\n\n\n"), bytes({'M'}));
+    EXPECT_THROW(decode("TQ==\nTWFu"), std::runtime_error);
+    EXPECT_THROW(decode("TWFuTWF"), std::runtime_error);
+    EXPECT_THROW(decode("TWFu\nTW.u"), std::runtime_error);
+    EXPECT_THROW(run_bulk(bulk::Operation::base64_encode, bytes(10), 4, 10), std::logic_error);
+    EXPECT_THROW(run_bulk(bulk::Operation::hex_encode, bytes(10), 4, 76), std::logic_error);
+}
+
+TEST(Bulk, files)
+{
+    bytes b = random_bytes(300000, 12);
+    bytes encoded = wrap(base64::from_bytes(b), 76, "\n");
+    char in_path[] = "/tmp/bulk_in_XXXXXX";
+    int fd = mkstemp(in_path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(write(fd, encoded.data(), encoded.size()), static_cast<ssize_t>(encoded.size()));
+    close(fd);
+    std::string out_path = std::string(in_path) + ".out";
+
+    EXPECT_EQ(bulk::transcode_file(bulk::Operation::base64_decode, in_path, out_path), b.size());
+    {
+        MappedFile out(out_path);
+        EXPECT_EQ(bytes(out.data(), out.data() + out.size()), b);
+    }
+
+    // A failed conversion does not leave a partial output behind
+    fd = open(in_path, O_WRONLY);
+    ASSERT_EQ(pwrite(fd, "!", 1, 1001), 1);
+    close(fd);
+    EXPECT_THROW(bulk::transcode_file(bulk::Operation::base64_decode, in_path, out_path),
+                 std::runtime_error);
+    EXPECT_NE(access(out_path.c_str(), F_OK), 0);
+    EXPECT_THROW(MappedFile("/nonexistent/file"), std::system_error);
+    unlink(in_path);
+}
+
+TEST(Aes128, known_answer)
+{
+    // NIST SP 800-38A, F.1.1 and F.2.1
+    bytes key = hex::to_bytes(std::string("2b7e151628aed2a6abf7158809cf4f3c"));
+    bytes iv = hex::to_bytes(std::string("000102030405060708090a0b0c0d0e0f"));
+    bytes plaintext = hex::to_bytes(
+        std::string("6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"));
+    Aes128 aes(key);
+
+    bytes ecb(plaintext.size());
+    aes.encrypt_blocks(plaintext.data(), plaintext.size(), ecb.data());
+    EXPECT_EQ(ecb, hex::to_bytes(std::string(
+                       "3ad77bb40d7a3660a89ecaf32466ef97f5d3d58503b9699de785895a96fdbaaf")));
+    bytes cbc = aes.encrypt_cbc(plaintext, iv);
+    EXPECT_EQ(bytes(cbc.begin(), cbc.begin() + 32),
+              hex::to_bytes(std::string(
+                  "7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2")));
+
+    // In place
+    bytes text = ecb;
+    aes.decrypt_blocks(text.data(), text.size(), text.data());
+    EXPECT_EQ(text, plaintext);
+}
+
+TEST(Aes128, matches_free_functions)
+{
+    bytes key = random_bytes(16, 1);
+    bytes iv = random_bytes(16, 2);
+    Aes128 aes(key);
+    for (size_t n : {0, 1, 15, 16, 17, 100, 1000})
+    {
+        bytes plaintext = random_bytes(n, static_cast<unsigned>(n));
+        bytes ecb = aes.encrypt_ecb(plaintext);
+        bytes cbc = aes.encrypt_cbc(plaintext, iv);
+        EXPECT_EQ(ecb, aes128_encrypt_ecb(plaintext, key));
+        EXPECT_EQ(cbc, aes128_encrypt_cbc(plaintext, key, iv));
+        EXPECT_EQ(aes.decrypt_ecb(ecb), plaintext);
+        EXPECT_EQ(aes.decrypt_cbc(cbc, iv), plaintext);
+        EXPECT_EQ(aes128_decrypt_ecb(ecb, key), plaintext);
+        EXPECT_EQ(aes128_decrypt_cbc(cbc, key, iv), plaintext);
+    }
+
+    // Several keys used in turns, copies and assignments get their own contexts
+    std::vector<Aes128> keys;
+    for (size_t i = 0; i < 8; i++)
+        keys.emplace_back(random_bytes(16, static_cast<unsigned>(100 + i)), AesBackend::openssl);
+    keys.push_back(keys[0]);
+    keys[1] = keys[2];
+    for (size_t round = 0; round < 3; round++)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            bytes plaintext = random_bytes(40, static_cast<unsigned>(i));
+            size_t seed = 100 + (i == keys.size() - 1 ? 0 : i == 1 ? 2 : i);
+            bytes k = random_bytes(16, static_cast<unsigned>(seed));
+            EXPECT_EQ(keys[i].encrypt_ecb(plaintext), aes128_encrypt_ecb(plaintext, k));
+        }
+    }
+
+    EXPECT_THROW(Aes128(random_bytes(15, 0)), std::logic_error);
+    EXPECT_THROW(aes.encrypt_cbc(bytes(16), bytes(8)), std::logic_error);
+    EXPECT_THROW(aes.decrypt_ecb(bytes(17)), std::runtime_error);
+}
+
+TEST(Aes128, cbc_matches_chained_blocks)
+{
+    Aes128 aes(random_bytes(16, 6));
+    for (size_t n : {0, 16, 31, 1000, 100000})
+    {
+        bytes plaintext = random_bytes(n, static_cast<unsigned>(n));
+        bytes iv = random_bytes(16, static_cast<unsigned>(n + 1));
+        // Chains the blocks by hand, one block at a time
+        bytes expected = pad_pkcs7(plaintext, 16);
+        bytes previous = iv;
+        for (size_t offset = 0; offset < expected.size(); offset += 16)
+        {
+            byte *block = expected.data() + offset;
+            for (size_t i = 0; i < 16; i++)
+                block[i] ^= previous[i];
+            aes.encrypt_blocks(block, 16, block);
+            previous.assign(block, block + 16);
+        }
+        bytes ciphertext = aes.encrypt_cbc(plaintext, iv);
+        EXPECT_EQ(ciphertext, expected);
+        EXPECT_EQ(aes.decrypt_cbc(ciphertext, iv), plaintext);
+    }
+}
+
+TEST(Aes128, backends)
+{
+    bytes key = random_bytes(16, 7);
+    Aes128 openssl(key, AesBackend::openssl);
+    EXPECT_EQ(openssl.backend(), AesBackend::openssl);
+    if (!cpu::features().aes)
+    {
+        EXPECT_THROW(Aes128(key, AesBackend::aesni), std::runtime_error);
+        return;
+    }
+    Aes128 aesni(key, AesBackend::aesni);
+    EXPECT_EQ(aesni.backend(), AesBackend::aesni);
+    EXPECT_EQ(Aes128(key).backend(), AesBackend::aesni);
+    EXPECT_EQ(Aes128(aesni).backend(), AesBackend::aesni);
+
+    // Every number of blocks around the 8 blocks processed together
+    bytes iv = random_bytes(16, 8);
+    for (size_t n = 0; n <= 40 * 16; n += 16)
+    {
+        bytes plaintext = random_bytes(n, static_cast<unsigned>(n));
+        bytes expected(n), ecb(n);
+        openssl.encrypt_blocks(plaintext.data(), n, expected.data());
+        aesni.encrypt_blocks(plaintext.data(), n, ecb.data());
+        EXPECT_EQ(ecb, expected);
+        aesni.decrypt_blocks(ecb.data(), n, ecb.data());
+        EXPECT_EQ(ecb, plaintext);
+
+        bytes cbc = aesni.encrypt_cbc(plaintext, iv);
+        EXPECT_EQ(cbc, openssl.encrypt_cbc(plaintext, iv));
+        EXPECT_EQ(aesni.decrypt_cbc(cbc, iv), plaintext);
+        EXPECT_EQ(aesni.encrypt_ecb(plaintext), openssl.encrypt_ecb(plaintext));
+    }
+    EXPECT_THROW(aesni.decrypt_cbc(bytes(17), iv), std::runtime_error);
+}
+
+TEST(Aes128, parallel)
+{
+    bytes key = random_bytes(16, 9);
+    bytes iv = random_bytes(16, 10);
+    ThreadPool pool(4);
+    std::vector<AesBackend> backends = {AesBackend::openssl};
+    if (cpu::features().aes)
+        backends.push_back(AesBackend::aesni);
+    for (AesBackend backend : backends)
+    {
+        Aes128 aes(key, backend);
+        for (size_t n : {0, 16, 160, 10000 * 16})
+        {
+            bytes plaintext = random_bytes(n, static_cast<unsigned>(n));
+            bytes ecb(n), cbc = aes.encrypt_cbc(plaintext, iv);
+            cbc.resize(n);
+            aes.encrypt_blocks(plaintext.data(), n, ecb.data());
+            // Segments that don't divide the input, and one that is not a whole number of blocks
+            for (size_t segment : {16, 48, 1000, 1 << 20})
+            {
+                bytes out(n);
+                parallel_aes::encrypt_blocks(aes, plaintext.data(), n, out.data(), pool, segment);
+                EXPECT_EQ(out, ecb);
+                parallel_aes::decrypt_blocks(aes, out.data(), n, out.data(), pool, segment);
+                EXPECT_EQ(out, plaintext);
+
+                parallel_aes::decrypt_cbc_blocks(aes, iv.data(), cbc.data(), n, out.data(), pool,
+                                                 segment);
+                EXPECT_EQ(out, plaintext);
+                out = cbc;
+                parallel_aes::decrypt_cbc_blocks(aes, iv.data(), out.data(), n, out.data(), pool,
+                                                 segment);
+                EXPECT_EQ(out, plaintext);
+            }
+            // In place without the pool
+            bytes out = cbc;
+            aes.decrypt_cbc_blocks(iv.data(), out.data(), n, out.data());
+            EXPECT_EQ(out, plaintext);
+        }
+        bytes plaintext = random_bytes(3 << 20, 11);
+        bytes ecb = parallel_aes::encrypt_ecb(aes, plaintext, pool);
+        EXPECT_EQ(ecb, aes.encrypt_ecb(plaintext));
+        EXPECT_EQ(parallel_aes::decrypt_ecb(aes, ecb, pool), plaintext);
+        EXPECT_EQ(parallel_aes::decrypt_cbc(aes, aes.encrypt_cbc(plaintext, iv), iv, pool),
+                  plaintext);
+        EXPECT_THROW(parallel_aes::decrypt_ecb(aes, bytes(17), pool), std::runtime_error);
+    }
+}
+
+TEST(Aes128, into_and_inplace)
+{
+    bytes key = random_bytes(16, 13);
+    bytes iv = random_bytes(16, 12);
+    std::vector<AesBackend> backends = {AesBackend::openssl};
+    if (cpu::features().aes)
+        backends.push_back(AesBackend::aesni);
+    for (AesBackend backend : backends)
+    {
+        Aes128 aes(key, backend);
+        for (size_t n = 0; n <= 200; n += 7)
+        {
+            bytes plaintext = random_bytes(n, static_cast<unsigned>(n));
+            bytes ecb = aes.encrypt_ecb(plaintext);
+            bytes cbc = aes.encrypt_cbc(plaintext, iv);
+            ASSERT_EQ(ecb.size(), pkcs7_padded_size(n, 16));
+            EXPECT_EQ(ecb, aes128_encrypt_ecb(plaintext, key));
+
+            // Caller buffer
+            bytes out(ecb.size());
+            EXPECT_EQ(aes.encrypt_ecb_into(plaintext.data(), n, out.data()), ecb.size());
+            EXPECT_EQ(out, ecb);
+            EXPECT_EQ(aes.decrypt_ecb_into(ecb.data(), ecb.size(), out.data()), n);
+            out.resize(n);
+            EXPECT_EQ(out, plaintext);
+            out.resize(ecb.size());
+            EXPECT_EQ(aes.encrypt_cbc_into(iv.data(), plaintext.data(), n, out.data()),
+                      cbc.size());
+            EXPECT_EQ(out, cbc);
+            EXPECT_EQ(aes.decrypt_cbc_into(iv.data(), cbc.data(), cbc.size(), out.data()), n);
+            out.resize(n);
+            EXPECT_EQ(out, plaintext);
+            out.resize(ecb.size());
+
+            // In place, the padding goes into the spare capacity
+            bytes buffer = plaintext;
+            buffer.reserve(pkcs7_padded_size(n, 16));
+            const byte *data = buffer.data();
+            aes.encrypt_ecb_inplace(buffer);
+            EXPECT_EQ(buffer, ecb);
+            EXPECT_EQ(buffer.data(), data);
+            aes.decrypt_ecb_inplace(buffer);
+            EXPECT_EQ(buffer, plaintext);
+            aes.encrypt_cbc_inplace(buffer, iv);
+            EXPECT_EQ(buffer, cbc);
+            aes.decrypt_cbc_inplace(buffer, iv);
+            EXPECT_EQ(buffer, plaintext);
+            EXPECT_EQ(buffer.data(), data);
+        }
+    }
+
+    bytes block(16, 0);
+    EXPECT_EQ(pad_pkcs7_into(block.data(), 13, 16), 16u);
+    EXPECT_EQ(block, bytes({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 3, 3}));
+    EXPECT_EQ(pkcs7_unpadded_size(block.data(), block.size(), 16), 13u);
+    EXPECT_THROW(pkcs7_unpadded_size(block.data(), 0, 16), std::runtime_error);
+    block[15] = 17;
+    EXPECT_THROW(pkcs7_unpadded_size(block.data(), block.size(), 16), std::runtime_error);
+}
+
+TEST(Aes128, threads)
+{
+    bytes key = random_bytes(16, 3);
+    bytes iv = random_bytes(16, 4);
+    // Static, like the oracle of a challenge, and destroyed after the threads are gone
+    static const Aes128 aes(key, AesBackend::openssl);
+    bytes plaintext = random_bytes(4096, 5);
+    bytes expected = aes128_encrypt_cbc(plaintext, key, iv);
+    EXPECT_EQ(aes.encrypt_cbc(plaintext, iv), expected);
+
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4, 0);
+    for (size_t t = 0; t < failures.size(); t++)
+    {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 50; i++)
+            {
+                if (aes.encrypt_cbc(plaintext, iv) != expected ||
+                    aes.decrypt_cbc(expected, iv) != plaintext)
+                    failures[t]++;
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    EXPECT_EQ(failures, std::vector<int>(failures.size(), 0));
+}
+
 int main(int argc, char *argv[])
 {
     ::testing::InitGoogleTest(&argc, argv);
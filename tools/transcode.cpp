@@ -0,0 +1,75 @@
+#include "bulk.hpp"
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts large files between raw bytes and hex / base64, using every core
+//   transcode [-j threads] [-w line_length] <operation> <input> <output>
+// where operation is one of hex-encode, hex-decode, base64-encode, base64-decode
+
+static int usage(const char *program)
+{
+    std::cerr << "Usage: " << program
+              << " [-j threads] [-w line_length] <operation> <input> <output>\n"
+              << "Operations: hex-encode, hex-decode, base64-encode, base64-decode\n"
+              << "  -j  number of threads (default: one per core)\n"
+              << "  -w  wrap base64-encode output every line_length characters\n";
+    return 2;
+}
+
+static bool parse_size(const char *s, size_t &value)
+{
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno != 0 || end == s || *end != '\0')
+        return false;
+    value = static_cast<size_t>(v);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t threads = 0;
+    bulk::Options options;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+        if (strcmp(argv[i], "-j") == 0 && parse_size(argv[i + 1], threads))
+            continue;
+        if (strcmp(argv[i], "-w") == 0 && parse_size(argv[i + 1], options.line_length))
+            continue;
+        return usage(argv[0]);
+    }
+    if (argc - i != 3)
+        return usage(argv[0]);
+
+    bulk::Operation op;
+    if (strcmp(argv[i], "hex-encode") == 0)
+        op = bulk::Operation::hex_encode;
+    else if (strcmp(argv[i], "hex-decode") == 0)
+        op = bulk::Operation::hex_decode;
+    else if (strcmp(argv[i], "base64-encode") == 0)
+        op = bulk::Operation::base64_encode;
+    else if (strcmp(argv[i], "base64-decode") == 0)
+        op = bulk::Operation::base64_decode;
+    else
+        return usage(argv[0]);
+
+    try
+    {
+        ThreadPool pool(threads);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t written = bulk::transcode_file(op, argv[i + 1], argv[i + 2], pool, options);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "Wrote " << written << " bytes in " << elapsed.count() << " s using "
+                  << pool.size() << " threads\n";
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}